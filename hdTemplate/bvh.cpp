@@ -0,0 +1,750 @@
+#include "bvh.h"
+
+#include "pxr/base/work/dispatcher.h"
+#include "pxr/base/work/loops.h"
+#include "pxr/base/work/sort.h"
+
+#include <chrono>
+#include <ostream>
+#include <numeric>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+typedef std::chrono::steady_clock BuildClock;
+
+static double SecondsSince(BuildClock::time_point start)
+{
+    return std::chrono::duration<double>(BuildClock::now() - start).count();
+}
+
+// Ranges of more than this many primitives are scanned in chunks on separate
+// threads, and their two subtrees are built as separate tasks. Below it the
+// work isn't worth the overhead of a task.
+static constexpr uint32_t ParallelBuildThreshold = 4096;
+
+// Call func(chunk, first, chunkCount) for chunks of ParallelBuildThreshold
+// indices covering [0, count), in parallel once there is more than one chunk.
+// Returns the number of chunks.
+template <class Func>
+static size_t ForEachChunk(uint32_t count, Func &&func)
+{
+    const size_t numChunks = (count + ParallelBuildThreshold - 1) / ParallelBuildThreshold;
+
+    auto runChunk = [&](size_t chunk)
+    {
+        const uint32_t first = static_cast<uint32_t>(chunk * ParallelBuildThreshold);
+        func(chunk, first, std::min(count - first, ParallelBuildThreshold));
+    };
+
+    if (numChunks <= 1)
+    {
+        runChunk(0);
+    }
+    else
+    {
+        WorkParallelForN(numChunks, [&](size_t begin, size_t end)
+        {
+            for (size_t chunk = begin; chunk < end; ++chunk)
+            {
+                runChunk(chunk);
+            }
+        });
+    }
+
+    return numChunks;
+}
+
+BVHSplit FindBVHSplit(const std::vector<BVHBounds> &primBounds,
+                      const std::vector<GfVec3f> &centroids,
+                      const uint32_t *indices, uint32_t count,
+                      const BVHBounds &centroidBounds, int numBins)
+{
+    BVHSplit best;
+    best.numBins = numBins;
+
+    float scale[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        scale[axis] = extent > 0.0f ? numBins / extent : 0.0f;
+    }
+
+    // Bin all three axes in one pass over the primitives. Large ranges are
+    // binned in chunks, each into bins of its own, which are merged after.
+    const size_t binsPerChunk = 3 * numBins;
+    const size_t maxChunks = (count + ParallelBuildThreshold - 1) / ParallelBuildThreshold;
+    std::vector<BVHBounds> chunkBinBounds(std::max<size_t>(maxChunks, 1) * binsPerChunk);
+    std::vector<uint32_t> chunkBinCounts(chunkBinBounds.size(), 0);
+
+    const size_t numChunks = ForEachChunk(count, [&](size_t chunk, uint32_t first, uint32_t chunkCount)
+    {
+        BVHBounds *binBounds = chunkBinBounds.data() + chunk * binsPerChunk;
+        uint32_t *binCounts = chunkBinCounts.data() + chunk * binsPerChunk;
+
+        for (uint32_t i = first; i < first + chunkCount; ++i)
+        {
+            const uint32_t prim = indices[i];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (scale[axis] == 0.0f)
+                    continue;
+                int bin = static_cast<int>((centroids[prim][axis] - centroidBounds.min[axis]) * scale[axis]);
+                bin = axis * numBins + std::min(bin, numBins - 1);
+                binBounds[bin].Grow(primBounds[prim]);
+                binCounts[bin]++;
+            }
+        }
+    });
+
+    for (size_t chunk = 1; chunk < numChunks; ++chunk)
+    {
+        for (size_t bin = 0; bin < binsPerChunk; ++bin)
+        {
+            chunkBinBounds[bin].Grow(chunkBinBounds[chunk * binsPerChunk + bin]);
+            chunkBinCounts[bin] += chunkBinCounts[chunk * binsPerChunk + bin];
+        }
+    }
+
+    std::vector<float> rightCost(numBins);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (scale[axis] == 0.0f)
+            continue;
+
+        const BVHBounds *binBounds = chunkBinBounds.data() + axis * numBins;
+        const uint32_t *binCounts = chunkBinCounts.data() + axis * numBins;
+
+        // Accumulate from the right so each candidate plane is O(1) to cost.
+        BVHBounds rightBounds;
+        uint32_t rightCount = 0;
+        for (int bin = numBins - 1; bin > 0; --bin)
+        {
+            rightBounds.Grow(binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightCost[bin] = rightBounds.GetHalfArea() * rightCount;
+        }
+
+        BVHBounds leftBounds;
+        uint32_t leftCount = 0;
+        for (int bin = 0; bin < numBins - 1; ++bin)
+        {
+            leftBounds.Grow(binBounds[bin]);
+            leftCount += binCounts[bin];
+            const float cost = leftBounds.GetHalfArea() * leftCount + rightCost[bin + 1];
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = bin + 1;
+                best.axisMin = centroidBounds.min[axis];
+                best.binScale = scale[axis];
+            }
+        }
+    }
+
+    return best;
+}
+
+void BVH::Clear()
+{
+    // clear() keeps the capacity, so a rebuild of similar size reuses the
+    // same node storage instead of allocating again.
+    _nodes.clear();
+    _primIndices.clear();
+    _sahCost = 0.0f;
+    _builtSAHCost = 0.0f;
+    _buildTime = 0.0;
+}
+
+bool BVH::Build(const std::vector<BVHBounds> &primBounds,
+                const BVHBuildOptions &options,
+                const std::atomic<bool> *cancel)
+{
+    const BuildClock::time_point start = BuildClock::now();
+
+    _Reset(options);
+
+    if (primBounds.empty())
+        return true;
+
+    const uint32_t numPrims = static_cast<uint32_t>(primBounds.size());
+
+    _primIndices.resize(numPrims);
+    std::iota(_primIndices.begin(), _primIndices.end(), 0);
+
+    std::vector<GfVec3f> centroids(numPrims);
+    ForEachChunk(numPrims, [&](size_t, uint32_t first, uint32_t count)
+    {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            centroids[i] = primBounds[i].GetCentroid();
+        }
+    });
+
+    // A binary tree over n primitives never has more than 2n - 1 nodes.
+    _nodes.reserve(2 * numPrims - 1);
+
+    _cancel = cancel;
+    _BuildRecursive(primBounds, centroids, _nodes, 0, numPrims, 0);
+    _cancel = nullptr;
+
+    if (cancel && cancel->load(std::memory_order_relaxed))
+    {
+        Clear();
+        return false;
+    }
+
+    _ComputeSAHCost();
+    _builtSAHCost = _sahCost;
+    _buildTime = SecondsSince(start);
+    return true;
+}
+
+void BVH::BuildLBVH(const std::vector<BVHBounds> &primBounds,
+                    const BVHBuildOptions &options)
+{
+    const BuildClock::time_point start = BuildClock::now();
+
+    _Reset(options);
+
+    if (primBounds.empty())
+        return;
+
+    const uint32_t numPrims = static_cast<uint32_t>(primBounds.size());
+
+    BVHBounds centroidBounds;
+    for (const BVHBounds &bounds : primBounds)
+    {
+        centroidBounds.Grow(bounds.GetCentroid());
+    }
+
+    float scale[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        scale[axis] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+    }
+
+    // Sort the primitives along a Morton curve through their centroids.
+    std::vector<std::pair<uint32_t, uint32_t>> keys(numPrims);
+    ForEachChunk(numPrims, [&](size_t, uint32_t first, uint32_t count)
+    {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const GfVec3f centroid = primBounds[i].GetCentroid();
+            uint32_t cell[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                cell[axis] = static_cast<uint32_t>((centroid[axis] - centroidBounds.min[axis]) * scale[axis]);
+            }
+            keys[i] = {EncodeMorton3(cell[0], cell[1], cell[2]), i};
+        }
+    });
+
+    WorkParallelSort(&keys);
+
+    std::vector<uint32_t> codes(numPrims);
+    _primIndices.resize(numPrims);
+    for (uint32_t i = 0; i < numPrims; ++i)
+    {
+        codes[i] = keys[i].first;
+        _primIndices[i] = keys[i].second;
+    }
+
+    _nodes.reserve(2 * numPrims - 1);
+
+    // The splits only depend on the codes, so the tree is laid out first and
+    // all node bounds are filled in afterwards in one bottom up pass.
+    _BuildLBVHRecursive(codes, _nodes, 0, numPrims, 29, 0);
+    _RefitNodes(primBounds);
+
+    _ComputeSAHCost();
+    _builtSAHCost = _sahCost;
+    _buildTime = SecondsSince(start);
+}
+
+uint32_t BVH::_BuildLBVHRecursive(const std::vector<uint32_t> &codes,
+                                  std::vector<BVHFlatNode> &nodes,
+                                  uint32_t begin, uint32_t end, int bit, int depth)
+{
+    const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    const uint32_t count = end - begin;
+
+    auto makeLeaf = [&]() {
+        nodes[nodeIndex].offset = begin;
+        nodes[nodeIndex].count = count;
+        return nodeIndex;
+    };
+
+    if (count <= _options.minLeafSize || depth >= MaxDepth - 1)
+        return makeLeaf();
+
+    // The codes are sorted, so bits the first and last code agree on are
+    // shared by the whole range. Split at the highest bit they differ in.
+    while (bit >= 0 && ((codes[begin] ^ codes[end - 1]) >> bit & 1u) == 0)
+    {
+        --bit;
+    }
+
+    uint32_t mid;
+    if (bit >= 0)
+    {
+        const uint32_t *first = codes.data() + begin;
+        mid = begin + static_cast<uint32_t>(
+            std::partition_point(first, first + count,
+                                 [bit](uint32_t code)
+                                 {
+                                     return (code >> bit & 1u) == 0;
+                                 }) - first);
+    }
+    else
+    {
+        // Every code in the range is the same, so just halve it.
+        if (count <= _options.maxLeafSize)
+            return makeLeaf();
+        mid = begin + count / 2;
+    }
+
+    uint32_t right;
+    if (count > ParallelBuildThreshold)
+    {
+        // Built in parallel and appended like in _BuildRecursive.
+        std::vector<BVHFlatNode> rightNodes;
+        WorkDispatcher dispatcher;
+        dispatcher.Run([&]()
+        {
+            rightNodes.reserve(2 * (end - mid) - 1);
+            _BuildLBVHRecursive(codes, rightNodes, mid, end, bit - 1, depth + 1);
+        });
+        _BuildLBVHRecursive(codes, nodes, begin, mid, bit - 1, depth + 1);
+        dispatcher.Wait();
+
+        right = static_cast<uint32_t>(nodes.size());
+        for (BVHFlatNode node : rightNodes)
+        {
+            if (!node.IsLeaf())
+                node.offset += right;
+            nodes.push_back(node);
+        }
+    }
+    else
+    {
+        _BuildLBVHRecursive(codes, nodes, begin, mid, bit - 1, depth + 1);
+        right = _BuildLBVHRecursive(codes, nodes, mid, end, bit - 1, depth + 1);
+    }
+
+    nodes[nodeIndex].offset = right;
+    nodes[nodeIndex].count = 0;
+
+    return nodeIndex;
+}
+
+bool BVH::Assign(std::vector<BVHFlatNode> nodes,
+                 std::vector<uint32_t> primIndices,
+                 const BVHBuildOptions &options)
+{
+    const BuildClock::time_point start = BuildClock::now();
+
+    _Reset(options);
+
+    const size_t numNodes = nodes.size();
+    const size_t numPrims = primIndices.size();
+    if ((numNodes == 0) != (numPrims == 0))
+        return false;
+
+    // Every primitive has to be referenced exactly once.
+    std::vector<bool> seen(numPrims, false);
+    for (uint32_t prim : primIndices)
+    {
+        if (prim >= numPrims || seen[prim])
+            return false;
+        seen[prim] = true;
+    }
+
+    // Children have to follow their parent, which also rules out cycles,
+    // and no leaf may be deeper than the traversal stacks allow for. Since
+    // parents come first, one forward pass finds every node's depth.
+    std::vector<int> depth(numNodes, 0);
+    for (size_t i = 0; i < numNodes; ++i)
+    {
+        const BVHFlatNode &node = nodes[i];
+        if (depth[i] >= MaxDepth)
+            return false;
+
+        if (node.IsLeaf())
+        {
+            if (static_cast<uint64_t>(node.offset) + node.count > numPrims)
+                return false;
+            continue;
+        }
+
+        if (i + 1 >= numNodes || node.offset <= i + 1 || node.offset >= numNodes)
+            return false;
+        depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+        depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
+    }
+
+    _nodes = std::move(nodes);
+    _primIndices = std::move(primIndices);
+
+    _ComputeSAHCost();
+    _builtSAHCost = _sahCost;
+    _buildTime = SecondsSince(start);
+
+    return true;
+}
+
+bool BVH::Refit(const std::vector<BVHBounds> &primBounds)
+{
+    if (_nodes.empty() || primBounds.size() != _primIndices.size())
+        return false;
+
+    const BuildClock::time_point start = BuildClock::now();
+
+    _RefitNodes(primBounds);
+
+    _ComputeSAHCost();
+    _buildTime = SecondsSince(start);
+
+    return _sahCost <= _builtSAHCost * _options.maxRefitSAHGrowth;
+}
+
+void BVH::_RefitNodes(const std::vector<BVHBounds> &primBounds)
+{
+    // Children are always stored after their parent, so walking the array
+    // backwards visits both children of a node before the node itself.
+    for (size_t i = _nodes.size(); i-- > 0;)
+    {
+        BVHFlatNode &node = _nodes[i];
+
+        BVHBounds bounds;
+        if (node.IsLeaf())
+        {
+            for (uint32_t p = node.offset; p < node.offset + node.count; ++p)
+            {
+                bounds.Grow(primBounds[_primIndices[p]]);
+            }
+        }
+        else
+        {
+            for (const BVHFlatNode *child : {&_nodes[i + 1], &_nodes[node.offset]})
+            {
+                BVHBounds childBounds;
+                childBounds.min = GfVec3f(child->min[0], child->min[1], child->min[2]);
+                childBounds.max = GfVec3f(child->max[0], child->max[1], child->max[2]);
+                bounds.Grow(childBounds);
+            }
+        }
+
+        for (int a = 0; a < 3; ++a)
+        {
+            node.min[a] = bounds.min[a];
+            node.max[a] = bounds.max[a];
+        }
+    }
+}
+
+void BVH::_Reset(const BVHBuildOptions &options)
+{
+    Clear();
+
+    _options = options;
+    _options.numBins = std::max(_options.numBins, 2);
+    _options.minLeafSize = std::max(_options.minLeafSize, 1u);
+    _options.maxLeafSize = std::max(_options.maxLeafSize, _options.minLeafSize);
+}
+
+void BVH::_ComputeSAHCost()
+{
+    _sahCost = 0.0f;
+    if (_nodes.empty())
+        return;
+
+    BVHBounds rootBounds = GetBounds();
+    const float rootArea = rootBounds.GetHalfArea();
+    if (rootArea <= 0.0f)
+        return;
+
+    double cost = 0.0;
+    for (const BVHFlatNode &node : _nodes)
+    {
+        BVHBounds bounds;
+        bounds.min = GfVec3f(node.min[0], node.min[1], node.min[2]);
+        bounds.max = GfVec3f(node.max[0], node.max[1], node.max[2]);
+
+        const float weight = node.IsLeaf() ? static_cast<float>(node.count) : _options.traversalCost;
+        cost += bounds.GetHalfArea() * weight;
+    }
+
+    _sahCost = static_cast<float>(cost / rootArea);
+}
+
+BVHBounds BVH::GetBounds() const
+{
+    BVHBounds bounds;
+    if (!_nodes.empty())
+    {
+        bounds.min = GfVec3f(_nodes[0].min[0], _nodes[0].min[1], _nodes[0].min[2]);
+        bounds.max = GfVec3f(_nodes[0].max[0], _nodes[0].max[1], _nodes[0].max[2]);
+    }
+    return bounds;
+}
+
+BVHStats BVH::ComputeStats() const
+{
+    BVHStats stats;
+    stats.numNodes = _nodes.size();
+    stats.numPrims = _primIndices.size();
+    stats.sahCost = _sahCost;
+    stats.memorySize = _nodes.capacity() * sizeof(BVHFlatNode) +
+                       _primIndices.capacity() * sizeof(uint32_t);
+    stats.buildTime = _buildTime;
+
+    if (_nodes.empty())
+        return stats;
+
+    auto getBounds = [](const BVHFlatNode &node)
+    {
+        BVHBounds bounds;
+        bounds.min = GfVec3f(node.min[0], node.min[1], node.min[2]);
+        bounds.max = GfVec3f(node.max[0], node.max[1], node.max[2]);
+        return bounds;
+    };
+
+    // Parents come before their children, so one forward pass finds every
+    // node's depth.
+    std::vector<uint32_t> depth(_nodes.size(), 0);
+    double overlap = 0.0;
+    for (size_t i = 0; i < _nodes.size(); ++i)
+    {
+        const BVHFlatNode &node = _nodes[i];
+
+        if (node.IsLeaf())
+        {
+            ++stats.numLeaves;
+            if (stats.leafDepths.size() <= depth[i])
+                stats.leafDepths.resize(depth[i] + 1, 0);
+            ++stats.leafDepths[depth[i]];
+            if (stats.leafSizes.size() <= node.count)
+                stats.leafSizes.resize(node.count + 1, 0);
+            ++stats.leafSizes[node.count];
+            continue;
+        }
+
+        depth[i + 1] = depth[i] + 1;
+        depth[node.offset] = depth[i] + 1;
+
+        const BVHBounds left = getBounds(_nodes[i + 1]);
+        const BVHBounds right = getBounds(_nodes[node.offset]);
+        BVHBounds both;
+        for (int a = 0; a < 3; ++a)
+        {
+            both.min[a] = std::max(left.min[a], right.min[a]);
+            both.max[a] = std::min(left.max[a], right.max[a]);
+        }
+        overlap += both.GetHalfArea();
+    }
+
+    const float rootArea = GetBounds().GetHalfArea();
+    if (rootArea > 0.0f)
+    {
+        stats.siblingOverlap = static_cast<float>(overlap / rootArea);
+    }
+
+    return stats;
+}
+
+void BVHStats::Merge(const BVHStats &other)
+{
+    const size_t totalPrims = numPrims + other.numPrims;
+    if (totalPrims > 0)
+    {
+        const double weight = static_cast<double>(other.numPrims) / totalPrims;
+        sahCost = static_cast<float>(sahCost * (1.0 - weight) + other.sahCost * weight);
+        siblingOverlap = static_cast<float>(siblingOverlap * (1.0 - weight) + other.siblingOverlap * weight);
+    }
+
+    numNodes += other.numNodes;
+    numLeaves += other.numLeaves;
+    numPrims = totalPrims;
+
+    if (leafDepths.size() < other.leafDepths.size())
+        leafDepths.resize(other.leafDepths.size(), 0);
+    for (size_t i = 0; i < other.leafDepths.size(); ++i)
+    {
+        leafDepths[i] += other.leafDepths[i];
+    }
+
+    if (leafSizes.size() < other.leafSizes.size())
+        leafSizes.resize(other.leafSizes.size(), 0);
+    for (size_t i = 0; i < other.leafSizes.size(); ++i)
+    {
+        leafSizes[i] += other.leafSizes[i];
+    }
+
+    memorySize += other.memorySize;
+    buildTime += other.buildTime;
+}
+
+void BVHStats::Dump(std::ostream &out) const
+{
+    out << "  nodes: " << numNodes << " (" << numLeaves << " leaves)\n"
+        << "  primitives: " << numPrims << "\n"
+        << "  SAH cost: " << sahCost << "\n"
+        << "  sibling overlap: " << siblingOverlap << "\n"
+        << "  memory: " << memorySize / 1024 << " KB\n"
+        << "  build time: " << buildTime * 1000.0 << " ms\n";
+
+    out << "  leaves by depth:";
+    for (size_t i = 0; i < leafDepths.size(); ++i)
+    {
+        if (leafDepths[i] > 0)
+            out << " " << i << ":" << leafDepths[i];
+    }
+
+    out << "\n  leaves by size:";
+    for (size_t i = 0; i < leafSizes.size(); ++i)
+    {
+        if (leafSizes[i] > 0)
+            out << " " << i << ":" << leafSizes[i];
+    }
+    out << "\n";
+}
+
+uint32_t BVH::_BuildRecursive(const std::vector<BVHBounds> &primBounds,
+                              const std::vector<GfVec3f> &centroids,
+                              std::vector<BVHFlatNode> &nodes,
+                              uint32_t begin, uint32_t end, int depth)
+{
+    const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    const uint32_t count = end - begin;
+
+    // A cancelled build is thrown away, so the rest of it only has to
+    // unwind: every range left becomes a leaf without even being bounded.
+    if (_cancel && _cancel->load(std::memory_order_relaxed))
+    {
+        nodes[nodeIndex].offset = begin;
+        nodes[nodeIndex].count = count;
+        return nodeIndex;
+    }
+
+    auto growRange = [&](uint32_t first, uint32_t last, BVHBounds &rangeBounds, BVHBounds &rangeCentroidBounds)
+    {
+        for (uint32_t i = first; i < last; ++i)
+        {
+            rangeBounds.Grow(primBounds[_primIndices[i]]);
+            rangeCentroidBounds.Grow(centroids[_primIndices[i]]);
+        }
+    };
+
+    BVHBounds bounds;
+    BVHBounds centroidBounds;
+    if (count <= ParallelBuildThreshold)
+    {
+        growRange(begin, end, bounds, centroidBounds);
+    }
+    else
+    {
+        std::vector<BVHBounds> chunkBounds(2 * ((count + ParallelBuildThreshold - 1) / ParallelBuildThreshold));
+        const size_t numChunks = ForEachChunk(count, [&](size_t chunk, uint32_t first, uint32_t chunkCount)
+        {
+            growRange(begin + first, begin + first + chunkCount,
+                      chunkBounds[2 * chunk], chunkBounds[2 * chunk + 1]);
+        });
+
+        for (size_t chunk = 0; chunk < numChunks; ++chunk)
+        {
+            bounds.Grow(chunkBounds[2 * chunk]);
+            centroidBounds.Grow(chunkBounds[2 * chunk + 1]);
+        }
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        nodes[nodeIndex].min[i] = bounds.min[i];
+        nodes[nodeIndex].max[i] = bounds.max[i];
+    }
+
+    auto makeLeaf = [&]() {
+        nodes[nodeIndex].offset = begin;
+        nodes[nodeIndex].count = count;
+        return nodeIndex;
+    };
+
+    if (count <= _options.minLeafSize || depth >= MaxDepth - 1)
+        return makeLeaf();
+
+    BVHSplit split = FindBVHSplit(primBounds, centroids,
+                                  _primIndices.data() + begin, count,
+                                  centroidBounds, _options.numBins);
+
+    // Compare against intersecting every primitive in a single leaf.
+    const float leafCost = bounds.GetHalfArea() * count;
+    const float splitCost = bounds.GetHalfArea() * _options.traversalCost + split.cost;
+    if (split.axis < 0 || splitCost >= leafCost)
+    {
+        if (count <= _options.maxLeafSize)
+            return makeLeaf();
+    }
+
+    uint32_t mid = begin;
+    if (split.axis >= 0)
+    {
+        auto it = std::partition(_primIndices.begin() + begin, _primIndices.begin() + end,
+                                 [&](uint32_t prim)
+                                 {
+                                     return split.IsLeft(centroids[prim]);
+                                 });
+        mid = static_cast<uint32_t>(it - _primIndices.begin());
+    }
+
+    // All centroids coincide (or the plane didn't separate anything), so just
+    // halve the range to keep the leaves small.
+    if (mid == begin || mid == end)
+    {
+        mid = begin + count / 2;
+    }
+
+    uint32_t right;
+    if (count > ParallelBuildThreshold)
+    {
+        // The subtrees cover disjoint ranges of _primIndices, so the right
+        // one can be built by another thread into nodes of its own. They're
+        // appended behind the left subtree once both are done, which keeps
+        // the same depth first layout as a serial build.
+        std::vector<BVHFlatNode> rightNodes;
+        WorkDispatcher dispatcher;
+        dispatcher.Run([&]()
+        {
+            rightNodes.reserve(2 * (end - mid) - 1);
+            _BuildRecursive(primBounds, centroids, rightNodes, mid, end, depth + 1);
+        });
+        _BuildRecursive(primBounds, centroids, nodes, begin, mid, depth + 1);
+        dispatcher.Wait();
+
+        right = static_cast<uint32_t>(nodes.size());
+        for (BVHFlatNode node : rightNodes)
+        {
+            if (!node.IsLeaf())
+                node.offset += right;
+            nodes.push_back(node);
+        }
+    }
+    else
+    {
+        _BuildRecursive(primBounds, centroids, nodes, begin, mid, depth + 1);
+        right = _BuildRecursive(primBounds, centroids, nodes, mid, end, depth + 1);
+    }
+
+    nodes[nodeIndex].offset = right;
+    nodes[nodeIndex].count = 0;
+
+    return nodeIndex;
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/base/gf/vec3f.h"
+#include "pxr/base/gf/ray.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Single precision axis aligned bounds used by the BVH builder and traversal.
+struct BVHBounds {
+    GfVec3f min = GfVec3f(std::numeric_limits<float>::max());
+    GfVec3f max = GfVec3f(-std::numeric_limits<float>::max());
+
+    void Grow(const GfVec3f &p) {
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], p[i]);
+            max[i] = std::max(max[i], p[i]);
+        }
+    }
+
+    void Grow(const BVHBounds &b) {
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], b.min[i]);
+            max[i] = std::max(max[i], b.max[i]);
+        }
+    }
+
+    bool IsEmpty() const {
+        return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+    }
+
+    GfVec3f GetCentroid() const {
+        return (min + max) * 0.5f;
+    }
+
+    // Half of the surface area, which is all the SAH needs.
+    float GetHalfArea() const {
+        if (IsEmpty())
+            return 0.0f;
+        GfVec3f d = max - min;
+        return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+    }
+};
+
+// A ray prepared for slab tests, with the reciprocal direction computed once.
+struct BVHRay {
+    BVHRay(const GfRay &ray, float tMin, float tMax)
+        : origin(ray.GetStartPoint())
+        , direction(ray.GetDirection())
+        , tMin(tMin)
+        , tMax(tMax)
+    {
+        for (int i = 0; i < 3; ++i) {
+            invDirection[i] = 1.0f / direction[i];
+        }
+    }
+
+    // For rays whose reciprocal direction is already known.
+    BVHRay(const GfVec3f &origin, const GfVec3f &direction,
+           const GfVec3f &invDirection, float tMin, float tMax)
+        : origin(origin)
+        , direction(direction)
+        , invDirection(invDirection)
+        , tMin(tMin)
+        , tMax(tMax)
+    {
+    }
+
+    GfVec3f origin;
+    GfVec3f direction;
+    GfVec3f invDirection;
+    float tMin;
+    float tMax;
+};
+
+// Interleave the low 10 bits of x, y and z into a 30 bit Morton code, so that
+// points close in space tend to get close codes.
+inline uint32_t EncodeMorton3(uint32_t x, uint32_t y, uint32_t z)
+{
+    auto expand = [](uint32_t v) {
+        v &= 0x3ffu;
+        v = (v | (v << 16)) & 0x030000ffu;
+        v = (v | (v << 8)) & 0x0300f00fu;
+        v = (v | (v << 4)) & 0x030c30c3u;
+        v = (v | (v << 2)) & 0x09249249u;
+        return v;
+    };
+    return (expand(x) << 2) | (expand(y) << 1) | expand(z);
+}
+
+// A node in the flattened BVH. Nodes are stored depth first in one array, so
+// the left child of an inner node always directly follows its parent.
+struct BVHFlatNode {
+    float min[3];
+    uint32_t offset;  // First primitive if a leaf, otherwise the right child.
+    float max[3];
+    uint32_t count;   // Number of primitives in a leaf, zero for inner nodes.
+
+    bool IsLeaf() const {
+        return count != 0;
+    }
+};
+
+static_assert(sizeof(BVHFlatNode) == 32, "BVHFlatNode should be 32 bytes");
+
+// Parameters of the binned SAH builder.
+struct BVHBuildOptions {
+    // Number of bins the SAH sweep evaluates per axis.
+    int numBins = 16;
+    // Ranges of at most this many primitives always become leaves.
+    uint32_t minLeafSize = 2;
+    // Ranges above this size are always split, even if the SAH disagrees.
+    uint32_t maxLeafSize = 16;
+    // Cost of visiting a node relative to intersecting one primitive.
+    float traversalCost = 1.0f;
+    // Refit reports the tree as worn out once its SAH cost grows past this
+    // multiple of the cost right after the last Build.
+    float maxRefitSAHGrowth = 1.5f;
+};
+
+// Shape and cost of a BVH, for telling when a scene produced a poor tree.
+struct BVHStats {
+    size_t numNodes = 0;
+    size_t numLeaves = 0;
+    size_t numPrims = 0;
+    // Number of leaves at each depth, the root being at depth 0.
+    std::vector<size_t> leafDepths;
+    // Number of leaves holding each primitive count.
+    std::vector<size_t> leafSizes;
+    // As BVH::GetSAHCost.
+    float sahCost = 0.0f;
+    // Surface area shared by the two children of every inner node, summed
+    // and relative to the surface area of the root.
+    float siblingOverlap = 0.0f;
+    // Bytes held by the tree and anything derived from it that its owner
+    // adds on, such as a wide layout or primitive data.
+    size_t memorySize = 0;
+    // Seconds taken by the build, refit or load that produced the tree.
+    double buildTime = 0.0;
+
+    // Add in the statistics of another tree, as if both were one. The SAH
+    // cost and overlap become averages weighted by primitive count.
+    void Merge(const BVHStats &other);
+
+    // Write the statistics out as indented lines of text.
+    void Dump(std::ostream &out) const;
+};
+
+// The best binned SAH split plane found for a range of primitives.
+struct BVHSplit {
+    // Split axis, or -1 when the centroids can't be separated.
+    int axis = -1;
+    // Primitives whose centroid falls in a bin below this one go left.
+    int bin = 0;
+    // Surface area weighted primitive count of both children, not yet
+    // normalised by the area of the parent.
+    float cost = std::numeric_limits<float>::max();
+
+    float axisMin = 0.0f;
+    float binScale = 0.0f;
+    int numBins = 0;
+
+    bool IsLeft(const GfVec3f &centroid) const {
+        int b = static_cast<int>((centroid[axis] - axisMin) * binScale);
+        return std::min(b, numBins - 1) < bin;
+    }
+};
+
+// Sweep all three axes of indices[0, count) with numBins bins each and return
+// the cheapest split plane.
+BVHSplit FindBVHSplit(const std::vector<BVHBounds> &primBounds,
+                      const std::vector<GfVec3f> &centroids,
+                      const uint32_t *indices, uint32_t count,
+                      const BVHBounds &centroidBounds, int numBins);
+
+// Binned SAH bounding volume hierarchy over an arbitrary set of primitives,
+// described only by their bounds.
+class BVH final {
+    public:
+        // Deeper trees are cut into leaves so traversal can use a fixed stack.
+        static constexpr int MaxDepth = 64;
+
+        // With cancel given, the build stops splitting once it's set, and
+        // returns false leaving the BVH empty. Otherwise returns true.
+        bool Build(const std::vector<BVHBounds> &primBounds,
+                   const BVHBuildOptions &options = BVHBuildOptions(),
+                   const std::atomic<bool> *cancel = nullptr);
+
+        // Linear BVH: sort the primitives along a Morton curve through their
+        // centroids and split ranges at the highest differing code bit. Much
+        // faster to build than Build, but traces noticeably slower, so it's
+        // meant to stand in until an SAH tree is ready. Only minLeafSize and
+        // maxLeafSize of the options are used.
+        void BuildLBVH(const std::vector<BVHBounds> &primBounds,
+                       const BVHBuildOptions &options = BVHBuildOptions());
+
+        // Recompute the bounds of every node bottom up for primitives that
+        // moved, keeping the tree itself. primBounds has to list the same
+        // primitives in the same order as the last Build. Returns false if
+        // the primitive count changed, leaving the tree untouched, or if the
+        // refit tree's SAH cost is past options.maxRefitSAHGrowth; either way
+        // the caller should Build instead.
+        bool Refit(const std::vector<BVHBounds> &primBounds);
+
+        // Adopt a tree built earlier, such as one read back from disk, as if
+        // Build had produced it with options. Returns false and leaves the
+        // BVH empty if the nodes don't form a tree over primIndices that
+        // traversal can handle.
+        bool Assign(std::vector<BVHFlatNode> nodes,
+                    std::vector<uint32_t> primIndices,
+                    const BVHBuildOptions &options);
+
+        void Clear();
+
+        bool IsEmpty() const {
+            return _nodes.empty();
+        }
+
+        BVHBounds GetBounds() const;
+
+        // SAH cost of the tree, relative to the surface area of its root.
+        float GetSAHCost() const {
+            return _sahCost;
+        }
+
+        const std::vector<BVHFlatNode> &GetNodes() const {
+            return _nodes;
+        }
+
+        // Walks the whole tree, so callers should keep the result around.
+        BVHStats ComputeStats() const;
+
+        // Leaves reference ranges of this array, which maps back to the
+        // primitive order that was passed to Build.
+        const std::vector<uint32_t> &GetPrimIndices() const {
+            return _primIndices;
+        }
+
+    private:
+        // Clear the tree and adopt options, clamped to sensible values.
+        void _Reset(const BVHBuildOptions &options);
+
+        // Build the subtree over _primIndices[begin, end) into nodes, whose
+        // indices are relative to that vector. Large ranges build their
+        // right subtree in parallel into a vector of its own.
+        uint32_t _BuildRecursive(const std::vector<BVHBounds> &primBounds,
+                                 const std::vector<GfVec3f> &centroids,
+                                 std::vector<BVHFlatNode> &nodes,
+                                 uint32_t begin, uint32_t end, int depth);
+
+        // Lay out the LBVH subtree over _primIndices[begin, end), whose
+        // sorted Morton codes are codes[begin, end) and agree above bit.
+        // Node bounds are left for _RefitNodes.
+        uint32_t _BuildLBVHRecursive(const std::vector<uint32_t> &codes,
+                                     std::vector<BVHFlatNode> &nodes,
+                                     uint32_t begin, uint32_t end, int bit, int depth);
+
+        // Recompute every node's bounds bottom up.
+        void _RefitNodes(const std::vector<BVHBounds> &primBounds);
+
+        void _ComputeSAHCost();
+
+        BVHBuildOptions _options;
+
+        // The cancel flag of the Build in progress, if any.
+        const std::atomic<bool> *_cancel = nullptr;
+
+        std::vector<BVHFlatNode> _nodes;
+        std::vector<uint32_t> _primIndices;
+
+        float _sahCost = 0.0f;
+        // _sahCost right after the last Build, which refits are judged by.
+        float _builtSAHCost = 0.0f;
+        // Seconds the last Build, BuildLBVH, Refit or Assign took.
+        double _buildTime = 0.0;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,354 @@
+#include "bvhCache.h"
+
+#include "pxr/base/arch/hash.h"
+#include "pxr/base/tf/diagnostic.h"
+#include "pxr/base/tf/envSetting.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+TF_DEFINE_ENV_SETTING(HDTEMPLATE_BVH_CACHE_DIR, "",
+                      "Directory that built mesh BVHs are cached in. Empty "
+                      "turns the cache off.");
+
+TF_DEFINE_ENV_SETTING(HDTEMPLATE_BVH_CACHE_SIZE_MB, 4096,
+                      "Size in megabytes that the BVH cache directory is kept "
+                      "under.");
+
+namespace {
+
+constexpr char BVHCacheMagic[8] = {'H', 'D', 'T', 'B', 'V', 'H', '\0', '\0'};
+
+// Start of every entry, followed by the nodes and then the prim indices.
+struct BVHCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize;
+    uint64_t key;
+    uint64_t numNodes;
+    uint64_t numPrims;
+};
+
+// Read-only view of a whole file, memory mapped where the platform allows.
+class MappedFile final {
+    public:
+        explicit MappedFile(const std::string &path)
+        {
+#if defined(_WIN32)
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file)
+                return;
+            _buffer.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            if (!file.read(_buffer.data(), _buffer.size()))
+                return;
+            _data = _buffer.data();
+            _size = _buffer.size();
+#else
+            const int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+
+            struct stat status;
+            if (fstat(fd, &status) == 0 && status.st_size > 0)
+            {
+                void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    // Entries are read front to back, once.
+                    madvise(data, status.st_size, MADV_SEQUENTIAL);
+                    _data = static_cast<const char *>(data);
+                    _size = static_cast<size_t>(status.st_size);
+                }
+            }
+            close(fd);
+#endif
+        }
+
+        ~MappedFile()
+        {
+#if !defined(_WIN32)
+            if (_data)
+                munmap(const_cast<char *>(_data), _size);
+#endif
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const {
+            return _data;
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+    private:
+        const char *_data = nullptr;
+        size_t _size = 0;
+#if defined(_WIN32)
+        std::vector<char> _buffer;
+#endif
+};
+
+struct CacheEntry {
+    std::filesystem::path path;
+    std::filesystem::file_time_type lastUsed;
+    uint64_t size;
+};
+
+// Every entry in directory, skipping anything that can't be read.
+std::vector<CacheEntry> ListEntries(const std::string &directory)
+{
+    std::vector<CacheEntry> entries;
+
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(directory, ec), end;
+         !ec && it != end; it.increment(ec))
+    {
+        if (it->path().extension() != ".bvh" || !it->is_regular_file(ec))
+            continue;
+
+        CacheEntry entry;
+        entry.path = it->path();
+        entry.lastUsed = it->last_write_time(ec);
+        entry.size = ec ? 0 : it->file_size(ec);
+        if (!ec)
+            entries.push_back(entry);
+        ec.clear();
+    }
+
+    return entries;
+}
+
+} // namespace
+
+static_assert(sizeof(BVHBounds) == 6 * sizeof(float),
+              "BVHBounds are hashed as raw bytes, so can't have padding");
+
+BVHCache &BVHCache::GetInstance()
+{
+    static BVHCache cache;
+    return cache;
+}
+
+BVHCache::BVHCache()
+{
+    const std::string directory = TfGetEnvSetting(HDTEMPLATE_BVH_CACHE_DIR);
+    if (directory.empty())
+        return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec)
+    {
+        TF_WARN("Can't use BVH cache directory %s: %s",
+                directory.c_str(), ec.message().c_str());
+        return;
+    }
+
+    _directory = directory;
+    _maxSize = static_cast<uint64_t>(std::max(TfGetEnvSetting(HDTEMPLATE_BVH_CACHE_SIZE_MB), 0)) << 20;
+
+    for (const CacheEntry &entry : ListEntries(_directory))
+    {
+        _size += entry.size;
+    }
+}
+
+uint64_t BVHCache::ComputeKey(const std::vector<BVHBounds> &primBounds,
+                              const BVHBuildOptions &options)
+{
+    // Only the options that shape the tree. The version goes in as well, so
+    // that a new builder doesn't pick up trees from an old one.
+    struct {
+        int32_t numBins;
+        uint32_t minLeafSize;
+        uint32_t maxLeafSize;
+        float traversalCost;
+    } shape = {options.numBins, options.minLeafSize, options.maxLeafSize, options.traversalCost};
+
+    const uint64_t key = ArchHash64(reinterpret_cast<const char *>(&shape), sizeof(shape), Version);
+    return ArchHash64(reinterpret_cast<const char *>(primBounds.data()),
+                      primBounds.size() * sizeof(BVHBounds), key);
+}
+
+std::string BVHCache::_GetPath(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(_directory) / name).string();
+}
+
+bool BVHCache::Load(uint64_t key, size_t numPrims, const BVHBuildOptions &options,
+                    BVH *bvh)
+{
+    if (!IsEnabled() || numPrims == 0)
+        return false;
+
+    const std::string path = _GetPath(key);
+
+    bool valid = false;
+    {
+        MappedFile file(path);
+        if (!file.data())
+            return false;
+
+        BVHCacheHeader header;
+        if (file.size() >= sizeof(header))
+        {
+            std::memcpy(&header, file.data(), sizeof(header));
+
+            // Check the counts before using them to compute the file size,
+            // so that a damaged header can't overflow it.
+            const bool headerValid =
+                std::memcmp(header.magic, BVHCacheMagic, sizeof(BVHCacheMagic)) == 0 &&
+                header.version == Version &&
+                header.nodeSize == sizeof(BVHFlatNode) &&
+                header.key == key &&
+                header.numPrims == numPrims &&
+                header.numNodes <= 2 * header.numPrims;
+
+            const size_t nodesSize = header.numNodes * sizeof(BVHFlatNode);
+            const size_t primsSize = header.numPrims * sizeof(uint32_t);
+
+            if (headerValid && file.size() == sizeof(header) + nodesSize + primsSize)
+            {
+                std::vector<BVHFlatNode> nodes(header.numNodes);
+                std::vector<uint32_t> primIndices(header.numPrims);
+                std::memcpy(nodes.data(), file.data() + sizeof(header), nodesSize);
+                std::memcpy(primIndices.data(), file.data() + sizeof(header) + nodesSize, primsSize);
+
+                valid = bvh->Assign(std::move(nodes), std::move(primIndices), options);
+            }
+        }
+    }
+
+    std::error_code ec;
+    if (!valid)
+    {
+        // Left by an older version or damaged. The caller builds the tree
+        // and stores a fresh entry.
+        TF_WARN("Discarding invalid BVH cache entry %s", path.c_str());
+        const uint64_t size = std::filesystem::file_size(path, ec);
+        if (!ec && std::filesystem::remove(path, ec))
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _size -= std::min(_size, size);
+        }
+        return false;
+    }
+
+    // The modification time doubles as the last use for eviction.
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+    return true;
+}
+
+void BVHCache::Store(uint64_t key, const BVH &bvh)
+{
+    if (!IsEnabled() || bvh.IsEmpty())
+        return;
+
+    const std::vector<BVHFlatNode> &nodes = bvh.GetNodes();
+    const std::vector<uint32_t> &primIndices = bvh.GetPrimIndices();
+
+    BVHCacheHeader header;
+    std::memcpy(header.magic, BVHCacheMagic, sizeof(BVHCacheMagic));
+    header.version = Version;
+    header.nodeSize = sizeof(BVHFlatNode);
+    header.key = key;
+    header.numNodes = nodes.size();
+    header.numPrims = primIndices.size();
+
+    // Write under a name no other thread or process uses, then rename it into
+    // place, so a reader never sees half an entry.
+    static thread_local std::mt19937_64 random(std::random_device{}());
+    const std::string path = _GetPath(key);
+    const std::string tmpPath = path + "." + std::to_string(random()) + ".tmp";
+
+    std::error_code ec;
+    {
+        std::ofstream file(tmpPath, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(BVHFlatNode));
+        file.write(reinterpret_cast<const char *>(primIndices.data()), primIndices.size() * sizeof(uint32_t));
+        file.close();
+
+        if (!file)
+        {
+            std::filesystem::remove(tmpPath, ec);
+            return;
+        }
+    }
+
+    // An entry already under this key, say from another process, is
+    // replaced rather than added to.
+    uint64_t replacedSize = std::filesystem::file_size(path, ec);
+    if (ec)
+    {
+        replacedSize = 0;
+    }
+
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tmpPath, ec);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _size -= std::min(_size, replacedSize);
+    _size += sizeof(header) + nodes.size() * sizeof(BVHFlatNode) + primIndices.size() * sizeof(uint32_t);
+    if (_size > _maxSize)
+    {
+        _Evict();
+    }
+}
+
+void BVHCache::_Evict()
+{
+    std::vector<CacheEntry> entries = ListEntries(_directory);
+    std::sort(entries.begin(), entries.end(),
+              [](const CacheEntry &a, const CacheEntry &b)
+              {
+                  return a.lastUsed < b.lastUsed;
+              });
+
+    // Other processes may have added or removed entries, so start over from
+    // what's actually there.
+    _size = 0;
+    for (const CacheEntry &entry : entries)
+    {
+        _size += entry.size;
+    }
+
+    const uint64_t targetSize = _maxSize - _maxSize / 4;
+
+    std::error_code ec;
+    for (const CacheEntry &entry : entries)
+    {
+        if (_size <= targetSize)
+            break;
+        if (std::filesystem::remove(entry.path, ec))
+        {
+            _size -= entry.size;
+        }
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "pxr/pxr.h"
+
+#include "bvh.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// On-disk cache of built BVHs, so that opening the same assets again skips
+// their SAH builds. Entries are keyed by a hash of everything that determines
+// the tree: the bounds of its primitives and the build options.
+//
+// The cache is off unless HDTEMPLATE_BVH_CACHE_DIR names a directory. Once
+// its entries add up to more than HDTEMPLATE_BVH_CACHE_SIZE_MB, the least
+// recently used ones are deleted. Several processes may share a directory;
+// entries are written under a temporary name and renamed into place.
+class BVHCache final {
+    public:
+        // Bump whenever the file layout or the trees Build produces change,
+        // so older entries are treated as misses.
+        static constexpr uint32_t Version = 1;
+
+        static BVHCache &GetInstance();
+
+        bool IsEnabled() const {
+            return !_directory.empty();
+        }
+
+        static uint64_t ComputeKey(const std::vector<BVHBounds> &primBounds,
+                                   const BVHBuildOptions &options);
+
+        // Read the BVH stored under key into bvh. Returns false if there is
+        // no such entry or it doesn't hold a valid tree over numPrims
+        // primitives, in which case the entry is deleted.
+        bool Load(uint64_t key, size_t numPrims, const BVHBuildOptions &options,
+                  BVH *bvh);
+
+        void Store(uint64_t key, const BVH &bvh);
+
+    private:
+        BVHCache();
+
+        std::string _GetPath(uint64_t key) const;
+
+        // Delete the least recently used entries until the cache is back
+        // under its size limit, leaving some room so that every store
+        // doesn't have to scan the directory again.
+        void _Evict();
+
+        std::string _directory;
+        uint64_t _maxSize = 0;
+
+        // Guards _size and eviction. Loads and stores run unlocked.
+        std::mutex _mutex;
+        // Total size of the entries, as far as this process knows.
+        uint64_t _size = 0;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,181 @@
+#include "compactMesh.h"
+
+#include "pxr/base/arch/hash.h"
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+static constexpr float QuantizedMax = std::numeric_limits<uint16_t>::max();
+
+CompactMesh::CompactMesh(const VtVec3fArray &points, const VtVec3iArray &indices,
+                         bool quantize)
+    : _numPoints(points.size())
+    , _numTriangles(indices.size())
+{
+    for (const GfVec3i &triangle : indices)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            if (triangle[j] < 0 || static_cast<size_t>(triangle[j]) >= _numPoints)
+            {
+                _valid = false;
+            }
+        }
+    }
+
+    // Every index of a valid mesh is below the number of points.
+    if (_valid && _numPoints <= size_t(std::numeric_limits<uint16_t>::max()) + 1)
+    {
+        _indices16.resize(3 * _numTriangles);
+        for (size_t i = 0; i < _numTriangles; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                _indices16[3 * i + j] = static_cast<uint16_t>(indices[i][j]);
+            }
+        }
+    }
+    else
+    {
+        _indices32.resize(3 * _numTriangles);
+        for (size_t i = 0; i < _numTriangles; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                _indices32[3 * i + j] = static_cast<uint32_t>(indices[i][j]);
+            }
+        }
+    }
+
+    // Quantize within the bounds of all points rather than just those the
+    // triangles use, so that decoded points stay where they were even if a
+    // later topology uses others.
+    BVHBounds pointBounds;
+    for (const GfVec3f &point : points)
+    {
+        pointBounds.Grow(point);
+    }
+
+    _quantized = quantize && !pointBounds.IsEmpty();
+    if (_quantized)
+    {
+        _origin = pointBounds.min;
+        for (int a = 0; a < 3; ++a)
+        {
+            _step[a] = (pointBounds.max[a] - pointBounds.min[a]) / QuantizedMax;
+        }
+
+        _quantizedPoints.resize(3 * _numPoints);
+        for (size_t i = 0; i < _numPoints; ++i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                const float steps = _step[a] > 0.0f ? (points[i][a] - _origin[a]) / _step[a] : 0.0f;
+                _quantizedPoints[3 * i + a] =
+                    static_cast<uint16_t>(std::clamp(std::lround(steps), 0l, long(QuantizedMax)));
+            }
+        }
+    }
+    else
+    {
+        _points.resize(3 * _numPoints);
+        for (size_t i = 0; i < _numPoints; ++i)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                _points[3 * i + a] = points[i][a];
+            }
+        }
+    }
+
+    if (!_valid)
+        return;
+
+    // Bound the points as decoded, since those are what is traced.
+    BVHBounds bounds;
+    for (size_t i = 0; i < _numTriangles; ++i)
+    {
+        const GfVec3i triangle = GetTriangle(i);
+        for (int j = 0; j < 3; ++j)
+        {
+            bounds.Grow(GetPoint(triangle[j]));
+        }
+    }
+
+    if (!bounds.IsEmpty())
+    {
+        _bounds = GfRange3d(GfVec3d(bounds.min), GfVec3d(bounds.max));
+    }
+}
+
+VtVec3fArray CompactMesh::DecodePoints() const
+{
+    VtVec3fArray points(_numPoints);
+    for (size_t i = 0; i < _numPoints; ++i)
+    {
+        points[i] = GetPoint(i);
+    }
+    return points;
+}
+
+VtVec3iArray CompactMesh::DecodeTriangles() const
+{
+    VtVec3iArray triangles(_numTriangles);
+    for (size_t i = 0; i < _numTriangles; ++i)
+    {
+        triangles[i] = GetTriangle(i);
+    }
+    return triangles;
+}
+
+size_t CompactMesh::GetMemorySize() const
+{
+    return _indices16.capacity() * sizeof(uint16_t) +
+           _indices32.capacity() * sizeof(uint32_t) +
+           _points.capacity() * sizeof(float) +
+           _quantizedPoints.capacity() * sizeof(uint16_t);
+}
+
+uint64_t CompactMesh::ComputeHash() const
+{
+    struct {
+        uint64_t numPoints;
+        uint64_t numTriangles;
+        float origin[3];
+        float step[3];
+        uint64_t quantized;
+    } header = {_numPoints, _numTriangles,
+                {_origin[0], _origin[1], _origin[2]},
+                {_step[0], _step[1], _step[2]},
+                _quantized};
+
+    uint64_t hash = ArchHash64(reinterpret_cast<const char *>(&header), sizeof(header));
+    hash = ArchHash64(reinterpret_cast<const char *>(_indices16.data()),
+                      _indices16.size() * sizeof(uint16_t), hash);
+    hash = ArchHash64(reinterpret_cast<const char *>(_indices32.data()),
+                      _indices32.size() * sizeof(uint32_t), hash);
+    hash = ArchHash64(reinterpret_cast<const char *>(_points.data()),
+                      _points.size() * sizeof(float), hash);
+    return ArchHash64(reinterpret_cast<const char *>(_quantizedPoints.data()),
+                      _quantizedPoints.size() * sizeof(uint16_t), hash);
+}
+
+bool CompactMesh::operator==(const CompactMesh &other) const
+{
+    return _numPoints == other._numPoints &&
+           _numTriangles == other._numTriangles &&
+           _quantized == other._quantized &&
+           _origin == other._origin &&
+           _step == other._step &&
+           _indices16 == other._indices16 &&
+           _indices32 == other._indices32 &&
+           _points == other._points &&
+           _quantizedPoints == other._quantizedPoints;
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
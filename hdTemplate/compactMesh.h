@@ -0,0 +1,116 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/base/gf/range3d.h"
+#include "pxr/base/gf/vec3f.h"
+#include "pxr/base/gf/vec3i.h"
+#include "pxr/base/vt/types.h"
+
+#include "mappedStorage.h"
+
+#include <cstdint>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// The points and triangles of a mesh in about as little memory as they can
+// be traced from: one flat index buffer, 16 bits per index when there are
+// few enough points, and the points optionally quantized to 16 bits per axis
+// within their bounds. Quantized meshes are traced from quantized triangle
+// records, which decode exactly like GetPoint, and GetBounds bounds that
+// rather than the points passed in.
+class CompactMesh final {
+    public:
+        CompactMesh(const VtVec3fArray &points, const VtVec3iArray &indices,
+                    bool quantize);
+
+        size_t GetNumPoints() const {
+            return _numPoints;
+        }
+
+        size_t GetNumTriangles() const {
+            return _numTriangles;
+        }
+
+        bool IsQuantized() const {
+            return _quantized;
+        }
+
+        // Whether every triangle indexes one of the points. Invalid meshes
+        // have empty bounds and nothing to trace, but still decode.
+        bool IsValid() const {
+            return _valid;
+        }
+
+        // A tight bound of every triangle as decoded.
+        const GfRange3d &GetBounds() const {
+            return _bounds;
+        }
+
+        GfVec3i GetTriangle(size_t index) const {
+            const size_t i = 3 * index;
+            if (!_indices16.empty()) {
+                return GfVec3i(_indices16[i], _indices16[i + 1], _indices16[i + 2]);
+            }
+            return GfVec3i(static_cast<int>(_indices32[i]),
+                           static_cast<int>(_indices32[i + 1]),
+                           static_cast<int>(_indices32[i + 2]));
+        }
+
+        GfVec3f GetPoint(size_t index) const {
+            const size_t i = 3 * index;
+            if (_quantized) {
+                return GfVec3f(_origin[0] + _step[0] * _quantizedPoints[i],
+                               _origin[1] + _step[1] * _quantizedPoints[i + 1],
+                               _origin[2] + _step[2] * _quantizedPoints[i + 2]);
+            }
+            return GfVec3f(_points[i], _points[i + 1], _points[i + 2]);
+        }
+
+        // Where quantized points are decoded relative to, and the size of
+        // their steps along each axis.
+        const GfVec3f &GetOrigin() const {
+            return _origin;
+        }
+
+        const GfVec3f &GetStep() const {
+            return _step;
+        }
+
+        // The three steps of a quantized point.
+        const uint16_t *GetQuantizedPoint(size_t index) const {
+            return _quantizedPoints.data() + 3 * index;
+        }
+
+        // The points and triangles back in the form they were given in,
+        // for meshes that only got new points or only a new topology.
+        VtVec3fArray DecodePoints() const;
+        VtVec3iArray DecodeTriangles() const;
+
+        size_t GetMemorySize() const;
+
+        // Hash of everything that is stored; equal meshes hash the same.
+        uint64_t ComputeHash() const;
+
+        bool operator==(const CompactMesh &other) const;
+
+    private:
+        size_t _numPoints = 0;
+        size_t _numTriangles = 0;
+        bool _valid = true;
+        bool _quantized = false;
+
+        // Three indices per triangle, in whichever of the two is used.
+        MappedVector<uint16_t> _indices16;
+        MappedVector<uint32_t> _indices32;
+
+        // Three coordinates per point, as floats or as steps of _step from
+        // _origin.
+        MappedVector<float> _points;
+        MappedVector<uint16_t> _quantizedPoints;
+        GfVec3f _origin{0.0f};
+        GfVec3f _step{0.0f};
+
+        GfRange3d _bounds;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,180 @@
+#include "instancer.h"
+
+#include "pxr/imaging/hd/perfLog.h"
+#include "pxr/imaging/hd/renderIndex.h"
+#include "pxr/imaging/hd/sceneDelegate.h"
+#include "pxr/imaging/hd/tokens.h"
+#include "pxr/base/gf/matrix4d.h"
+#include "pxr/base/gf/quatd.h"
+#include "pxr/base/gf/quatf.h"
+#include "pxr/base/gf/quath.h"
+#include "pxr/base/gf/vec3d.h"
+#include "pxr/base/gf/vec4f.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Read element index of the Array held by value, if it holds one that long.
+template <class Array, class T>
+static bool SampleArray(const VtValue &value, int index, T *out)
+{
+    if (!value.IsHolding<Array>())
+        return false;
+
+    const Array &array = value.UncheckedGet<Array>();
+    if (index < 0 || static_cast<size_t>(index) >= array.size())
+        return false;
+
+    *out = T(array[index]);
+    return true;
+}
+
+static bool SampleVec3(const VtValue &value, int index, GfVec3d *out)
+{
+    return SampleArray<VtVec3fArray>(value, index, out) ||
+           SampleArray<VtVec3dArray>(value, index, out);
+}
+
+static bool SampleRotation(const VtValue &value, int index, GfQuatd *out)
+{
+    if (SampleArray<VtQuathArray>(value, index, out) ||
+        SampleArray<VtQuatfArray>(value, index, out))
+        return true;
+
+    // Older scene delegates pass quaternions as vectors, real part first.
+    GfVec4f rotation;
+    if (SampleArray<VtVec4fArray>(value, index, &rotation))
+    {
+        *out = GfQuatd(rotation[0], rotation[1], rotation[2], rotation[3]);
+        return true;
+    }
+
+    return false;
+}
+
+HdTemplateInstancer::HdTemplateInstancer(HdSceneDelegate *delegate, SdfPath const &id)
+    : HdInstancer(delegate, id)
+{
+}
+
+HdTemplateInstancer::~HdTemplateInstancer() = default;
+
+void HdTemplateInstancer::Sync(HdSceneDelegate *sceneDelegate,
+                               HdRenderParam *renderParam,
+                               HdDirtyBits *dirtyBits)
+{
+    TF_UNUSED(renderParam);
+
+    _UpdateInstancer(sceneDelegate, dirtyBits);
+
+    if (HdChangeTracker::IsAnyPrimvarDirty(*dirtyBits, GetId()))
+    {
+        _SyncPrimvars(sceneDelegate, *dirtyBits);
+    }
+}
+
+void HdTemplateInstancer::_SyncPrimvars(HdSceneDelegate *sceneDelegate,
+                                        HdDirtyBits dirtyBits)
+{
+    HD_TRACE_FUNCTION();
+
+    SdfPath const &id = GetId();
+
+    const HdPrimvarDescriptorVector primvars =
+        sceneDelegate->GetPrimvarDescriptors(id, HdInterpolationInstance);
+    for (HdPrimvarDescriptor const &pv : primvars)
+    {
+        if (!HdChangeTracker::IsPrimvarDirty(dirtyBits, id, pv.name))
+            continue;
+
+        VtValue value = sceneDelegate->Get(id, pv.name);
+        if (value.IsEmpty())
+        {
+            _primvarMap.erase(pv.name);
+        }
+        else
+        {
+            _primvarMap[pv.name] = value;
+        }
+    }
+}
+
+VtMatrix4dArray HdTemplateInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId)
+{
+    HD_TRACE_FUNCTION();
+
+    HdSceneDelegate *delegate = GetDelegate();
+    const GfMatrix4d instancerTransform = delegate->GetInstancerTransform(GetId());
+    const VtIntArray instanceIndices = delegate->GetInstanceIndices(GetId(), prototypeId);
+
+    auto findPrimvar = [this](const TfToken &name) -> const VtValue *
+    {
+        auto it = _primvarMap.find(name);
+        return it != _primvarMap.end() ? &it->second : nullptr;
+    };
+
+    const VtValue *translations = findPrimvar(HdInstancerTokens->instanceTranslations);
+    const VtValue *rotations = findPrimvar(HdInstancerTokens->instanceRotations);
+    const VtValue *scales = findPrimvar(HdInstancerTokens->instanceScales);
+    const VtValue *instanceTransforms = findPrimvar(HdInstancerTokens->instanceTransforms);
+
+    // Every instance is placed by instanceTransform * scale * rotate *
+    // translate * instancerTransform, where whatever isn't given is the
+    // identity.
+    VtMatrix4dArray transforms(instanceIndices.size());
+    for (size_t i = 0; i < instanceIndices.size(); ++i)
+    {
+        const int index = instanceIndices[i];
+        GfMatrix4d transform = instancerTransform;
+
+        GfVec3d translation;
+        if (translations && SampleVec3(*translations, index, &translation))
+        {
+            transform = GfMatrix4d(1.0).SetTranslate(translation) * transform;
+        }
+
+        GfQuatd rotation;
+        if (rotations && SampleRotation(*rotations, index, &rotation))
+        {
+            transform = GfMatrix4d(1.0).SetRotate(rotation) * transform;
+        }
+
+        GfVec3d scale;
+        if (scales && SampleVec3(*scales, index, &scale))
+        {
+            transform = GfMatrix4d(1.0).SetScale(scale) * transform;
+        }
+
+        GfMatrix4d instanceTransform;
+        if (instanceTransforms && SampleArray<VtMatrix4dArray>(*instanceTransforms, index, &instanceTransform))
+        {
+            transform = instanceTransform * transform;
+        }
+
+        transforms[i] = transform;
+    }
+
+    if (GetParentId().IsEmpty())
+        return transforms;
+
+    // A nested instancer is itself instanced by its parent, so each of its
+    // instances appears once per instance of the parent.
+    HdInstancer *parent = delegate->GetRenderIndex().GetInstancer(GetParentId());
+    if (!TF_VERIFY(parent))
+        return transforms;
+
+    const VtMatrix4dArray parentTransforms =
+        static_cast<HdTemplateInstancer *>(parent)->ComputeInstanceTransforms(GetId());
+
+    VtMatrix4dArray nestedTransforms(parentTransforms.size() * transforms.size());
+    for (size_t i = 0; i < parentTransforms.size(); ++i)
+    {
+        for (size_t j = 0; j < transforms.size(); ++j)
+        {
+            nestedTransforms[i * transforms.size() + j] = transforms[j] * parentTransforms[i];
+        }
+    }
+
+    return nestedTransforms;
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
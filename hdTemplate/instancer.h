@@ -0,0 +1,41 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/imaging/hd/instancer.h"
+#include "pxr/base/tf/hashmap.h"
+#include "pxr/base/tf/token.h"
+#include "pxr/base/vt/types.h"
+#include "pxr/base/vt/value.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Point instancer. Keeps the instance primvars that place each instance and
+// resolves them, together with any instancers this one is nested in, into a
+// transform per instance of a prototype.
+//
+// Prototypes aren't copied per instance: a prototype mesh keeps one object
+// space BVH and places it once per transform returned here.
+class HdTemplateInstancer final : public HdInstancer
+{
+public:
+    HdTemplateInstancer(HdSceneDelegate *delegate, SdfPath const &id);
+
+    ~HdTemplateInstancer() override;
+
+    void Sync(HdSceneDelegate *sceneDelegate,
+              HdRenderParam *renderParam,
+              HdDirtyBits *dirtyBits) override;
+
+    // Transform of every instance of prototypeId, to be applied after the
+    // prototype's own transform. Nested instancers multiply the count by
+    // their own instances. May be called by several prototypes at once.
+    VtMatrix4dArray ComputeInstanceTransforms(SdfPath const &prototypeId);
+
+private:
+    void _SyncPrimvars(HdSceneDelegate *sceneDelegate, HdDirtyBits dirtyBits);
+
+    // Instance primvars by name, as last pulled from the scene delegate.
+    TfHashMap<TfToken, VtValue, TfToken::HashFunctor> _primvarMap;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,281 @@
+#include "integrator.h"
+
+#include "pxr/imaging/hd/perfLog.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+static float randomFloat()
+{
+    return ((float)(rand()) / (float)(RAND_MAX)-0.5f) * 2.0f;
+}
+
+// Helper function to generate a random vector within a hemisphere
+static GfVec3f RandomHemisphereDirection(const GfVec3f &normal)
+{
+    // Create a random vector in the tangent plane
+    GfVec3f randomDirection;
+
+    while (true)
+    {
+        randomDirection = GfVec3f(randomFloat(), randomFloat(), randomFloat());
+
+        if (randomDirection.GetLength() < 1.0f)
+        {
+            randomDirection = randomDirection.GetNormalized();
+            break;
+        }
+    }
+
+    // If the normal is pointing upwards (or along a specific axis), make sure the random vector is in the hemisphere
+    if (randomDirection * normal < 0.0f)
+    {
+        randomDirection = -randomDirection; // Reflect the vector to ensure it's in the correct hemisphere
+    }
+
+    return randomDirection;
+};
+
+static GfVec3f clamp(GfVec3f a, GfVec3f b) {
+    return GfVec3f(std::min(a[0], b[0]),std::min(a[1], b[1]),std::min(a[2], b[2]));
+}
+
+void RayQueue::Clear()
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        origin[a].clear();
+        direction[a].clear();
+    }
+    path.clear();
+}
+
+void RayQueue::Push(uint32_t pathIndex, const GfVec3f &rayOrigin, const GfVec3f &rayDirection)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        origin[a].push_back(rayOrigin[a]);
+        direction[a].push_back(rayDirection[a]);
+    }
+    path.push_back(pathIndex);
+}
+
+void RayQueue::Sort()
+{
+    const size_t count = size();
+    if (count < 2)
+        return;
+
+    BVHBounds bounds;
+    for (size_t i = 0; i < count; ++i)
+    {
+        bounds.Grow(GfVec3f(origin[0][i], origin[1][i], origin[2][i]));
+    }
+
+    // The octant goes above a 30 bit Morton code of the origin.
+    float scale[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        const float extent = bounds.max[a] - bounds.min[a];
+        scale[a] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+    }
+
+    _keys.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t cell[3];
+        uint32_t octant = 0;
+        for (int a = 0; a < 3; ++a)
+        {
+            cell[a] = static_cast<uint32_t>((origin[a][i] - bounds.min[a]) * scale[a]);
+            octant |= (direction[a][i] < 0.0f ? 1u : 0u) << a;
+        }
+        _keys[i] = {(static_cast<uint64_t>(octant) << 30) | EncodeMorton3(cell[0], cell[1], cell[2]),
+                    static_cast<uint32_t>(i)};
+    }
+
+    std::sort(_keys.begin(), _keys.end());
+
+    auto permute = [&](std::vector<float> &values)
+    {
+        _scratch.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            _scratch[i] = values[_keys[i].second];
+        }
+        values.swap(_scratch);
+    };
+
+    for (int a = 0; a < 3; ++a)
+    {
+        permute(origin[a]);
+        permute(direction[a]);
+    }
+
+    _pathScratch.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        _pathScratch[i] = path[_keys[i].second];
+    }
+    path.swap(_pathScratch);
+}
+
+void WavefrontIntegrator::Render(const SceneData &scene, const GfRay *rays, size_t numRays,
+                                 int numBounces, bool packets, HitData *hits)
+{
+    HD_TRACE_FUNCTION();
+
+    _hits.resize(numRays);
+    _rays.assign(rays, rays + numRays);
+    _radiance.assign(numRays, GfVec3f(0.0f));
+    _throughput.assign(numRays, 1.0f);
+    _direct.resize(numRays);
+
+    _TraceCamera(scene, rays, numRays, packets, hits);
+    _cameraHits = _active;
+
+    // Each pass shades the hits of every live path, so the last pass
+    // needs no extension rays.
+    for (int depth = numBounces; depth > 0 && !_active.empty(); --depth)
+    {
+        _Shade(depth > 1);
+        _TraceShadows(scene);
+        _TraceExtensions(scene);
+    }
+
+    for (uint32_t path : _cameraHits)
+    {
+        const GfVec3f &Cd = _radiance[path];
+        hits[path].Cd = GfVec4f(Cd[0], Cd[1], Cd[2], 1.0f);
+    }
+}
+
+void WavefrontIntegrator::_TraceCamera(const SceneData &scene, const GfRay *rays, size_t numRays,
+                                       bool packets, HitData *hits)
+{
+    HD_TRACE_FUNCTION();
+
+    for (size_t i = 0; i < numRays; ++i)
+    {
+        _hits[i] = IntersectData{
+            std::numeric_limits<double>::infinity(),
+            GfVec3f(0.0f)};
+    }
+
+    if (packets)
+    {
+        for (size_t i = 0; i < numRays; i += RayPacketSize)
+        {
+            const int count = static_cast<int>(std::min<size_t>(RayPacketSize, numRays - i));
+            scene.IntersectPacket(rays + i, count, _hits.data() + i);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < numRays; ++i)
+        {
+            scene.Intersect(rays[i], _hits[i]);
+        }
+    }
+
+    // The primary hit fills every AOV but color, which the bounces add up.
+    _active.clear();
+    for (uint32_t path = 0; path < numRays; ++path)
+    {
+        const IntersectData &it = _hits[path];
+        if (it.t < std::numeric_limits<double>::infinity())
+        {
+            hits[path] = HitData{
+                GfVec4f(0.0f, 0.0f, 0.0f, 1.0f),
+                it.N,
+                GfVec3f(rays[path].GetPoint(it.t)),
+                static_cast<float>(it.t)};
+            _active.push_back(path);
+        }
+        else
+        {
+            hits[path] = HitData{};
+        }
+    }
+}
+
+void WavefrontIntegrator::_Shade(bool extend)
+{
+    HD_TRACE_FUNCTION();
+
+    const GfVec3f light = GfVec3f(-12, -9, -8).GetNormalized();
+    const float intensity = 2.0f;
+
+    _shadowQueue.Clear();
+    _extensionQueue.Clear();
+
+    for (uint32_t path : _active)
+    {
+        const IntersectData &it = _hits[path];
+        const GfVec3f P(_rays[path].GetPoint(it.t));
+
+        float illum = std::max(it.N * -light, 0.0f) * intensity;
+
+        // Surfaces facing away from the light are unlit whether or not
+        // they're shadowed, so only trace the shadow ray when it can make a
+        // difference.
+        if (illum > 0.0f)
+        {
+            _direct[path] = clamp(it.Cd * illum, GfVec3f(1.0f)) * _throughput[path];
+            _shadowQueue.Push(path, P, -light);
+        }
+
+        if (extend)
+        {
+            _extensionQueue.Push(path, P, RandomHemisphereDirection(it.N));
+            _throughput[path] *= it.Cd.GetLength();
+        }
+    }
+}
+
+void WavefrontIntegrator::_TraceShadows(const SceneData &scene)
+{
+    HD_TRACE_FUNCTION();
+
+    _shadowQueue.Sort();
+
+    for (size_t i = 0; i < _shadowQueue.size(); ++i)
+    {
+        if (!scene.Occluded(_shadowQueue.GetRay(i), 0.0001f, std::numeric_limits<float>::infinity()))
+        {
+            const uint32_t path = _shadowQueue.path[i];
+            _radiance[path] += _direct[path];
+        }
+    }
+}
+
+void WavefrontIntegrator::_TraceExtensions(const SceneData &scene)
+{
+    HD_TRACE_FUNCTION();
+
+    _extensionQueue.Sort();
+
+    _active.clear();
+    for (size_t i = 0; i < _extensionQueue.size(); ++i)
+    {
+        const uint32_t path = _extensionQueue.path[i];
+
+        _rays[path] = _extensionQueue.GetRay(i);
+        _hits[path] = IntersectData{
+            std::numeric_limits<double>::infinity(),
+            GfVec3f(0.0f)};
+
+        scene.Intersect(_rays[path], _hits[path]);
+
+        // Paths that leave the scene are done.
+        if (_hits[path].t < std::numeric_limits<double>::infinity())
+        {
+            _active.push_back(path);
+        }
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
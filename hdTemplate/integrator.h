@@ -0,0 +1,91 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/base/gf/ray.h"
+#include "pxr/base/gf/vec3f.h"
+
+#include "sceneData.h"
+
+#include <cstdint>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Rays waiting for the same stage of the integrator, stored as structure of
+// arrays. Each ray remembers the path it belongs to.
+struct RayQueue {
+    std::vector<float> origin[3];
+    std::vector<float> direction[3];
+    std::vector<uint32_t> path;
+
+    size_t size() const {
+        return path.size();
+    }
+
+    bool empty() const {
+        return path.empty();
+    }
+
+    void Clear();
+
+    void Push(uint32_t pathIndex, const GfVec3f &rayOrigin, const GfVec3f &rayDirection);
+
+    GfRay GetRay(size_t i) const {
+        return GfRay(GfVec3d(origin[0][i], origin[1][i], origin[2][i]),
+                     GfVec3d(direction[0][i], direction[1][i], direction[2][i]));
+    }
+
+    // Reorder by direction octant, then by the Morton code of the origin
+    // within the queue's bounds, so consecutive rays take similar paths
+    // through the BVHs.
+    void Sort();
+
+  private:
+    std::vector<std::pair<uint64_t, uint32_t>> _keys;
+    std::vector<float> _scratch;
+    std::vector<uint32_t> _pathScratch;
+};
+
+// Path tracer that advances a whole batch of paths one bounce at a time
+// instead of following each path to the end. Every bounce runs as separate
+// stages over queues of rays: shade the current hits, trace their shadow
+// rays, then trace the rays extending the paths.
+//
+// Queues are kept between calls, so reusing one integrator for every tile a
+// thread renders avoids reallocating them.
+class WavefrontIntegrator final {
+    public:
+        // Trace and shade the camera rays, filling hits[i] for rays[i]. With
+        // packets set, camera rays are traced RayPacketSize at a time, which
+        // pays off when consecutive rays go through neighbouring pixels.
+        void Render(const SceneData &scene, const GfRay *rays, size_t numRays,
+                    int numBounces, bool packets, HitData *hits);
+
+    private:
+        void _TraceCamera(const SceneData &scene, const GfRay *rays, size_t numRays,
+                          bool packets, HitData *hits);
+
+        void _Shade(bool extend);
+
+        void _TraceShadows(const SceneData &scene);
+
+        void _TraceExtensions(const SceneData &scene);
+
+        // Per path state, indexed by path.
+        std::vector<IntersectData> _hits;
+        std::vector<GfRay> _rays;
+        std::vector<GfVec3f> _radiance;
+        std::vector<float> _throughput;
+        // Light a path's current hit receives if its shadow ray is unblocked.
+        std::vector<GfVec3f> _direct;
+
+        // Paths whose current ray hit something.
+        std::vector<uint32_t> _active;
+        // Paths whose camera ray hit something.
+        std::vector<uint32_t> _cameraHits;
+
+        RayQueue _shadowQueue;
+        RayQueue _extensionQueue;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
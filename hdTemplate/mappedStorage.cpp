@@ -0,0 +1,194 @@
+#include "mappedStorage.h"
+
+#include "pxr/base/tf/diagnostic.h"
+#include "pxr/base/tf/envSetting.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+TF_DEFINE_ENV_SETTING(HDTEMPLATE_OUT_OF_CORE_DIR, "",
+                      "Directory to memory map large geometry allocations "
+                      "from. Empty keeps them in memory.");
+
+TF_DEFINE_ENV_SETTING(HDTEMPLATE_OUT_OF_CORE_RESIDENT_MB, 0,
+                      "Megabytes of memory mapped geometry kept resident "
+                      "between samples. 0 leaves it to the OS.");
+
+#if !defined(_WIN32)
+
+// Bytes of [p, p + size) currently in memory.
+static uint64_t GetResidentSize(char *p, size_t size, size_t pageSize,
+                                std::vector<unsigned char> &residency)
+{
+    residency.resize((size + pageSize - 1) / pageSize);
+#if defined(__APPLE__)
+    if (mincore(p, size, reinterpret_cast<char *>(residency.data())) != 0)
+        return 0;
+#else
+    if (mincore(p, size, residency.data()) != 0)
+        return 0;
+#endif
+
+    uint64_t numPages = 0;
+    for (unsigned char page : residency)
+    {
+        numPages += page & 1;
+    }
+    return numPages * pageSize;
+}
+
+// Write back and release the pages of [p, p + size). They are read back from
+// the file if touched again.
+static void PageOut(char *p, size_t size)
+{
+#if defined(MADV_PAGEOUT)
+    if (madvise(p, size, MADV_PAGEOUT) == 0)
+        return;
+#endif
+    msync(p, size, MS_SYNC);
+    madvise(p, size, MADV_DONTNEED);
+}
+
+#endif
+
+MappedStorage &MappedStorage::GetInstance()
+{
+    static MappedStorage storage;
+    return storage;
+}
+
+MappedStorage::MappedStorage()
+{
+    const std::string directory = TfGetEnvSetting(HDTEMPLATE_OUT_OF_CORE_DIR);
+    if (directory.empty())
+        return;
+
+#if defined(_WIN32)
+    TF_WARN("Out of core geometry isn't supported on this platform");
+#else
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec)
+    {
+        TF_WARN("Can't use out of core directory %s: %s",
+                directory.c_str(), ec.message().c_str());
+        return;
+    }
+
+    _directory = directory;
+    _residentBudget = static_cast<uint64_t>(std::max(TfGetEnvSetting(HDTEMPLATE_OUT_OF_CORE_RESIDENT_MB), 0)) << 20;
+#endif
+}
+
+void *MappedStorage::Allocate(size_t size, size_t alignment)
+{
+    // Mappings are page aligned, which covers any alignment asked for.
+    if (IsEnabled() && size >= MinMappedSize)
+    {
+        if (void *p = _Map(size))
+            return p;
+    }
+
+    return ::operator new(size, std::align_val_t(alignment));
+}
+
+void MappedStorage::Deallocate(void *p, size_t size, size_t alignment)
+{
+    if (IsEnabled() && size >= MinMappedSize)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Allocations that couldn't be mapped fell back to the heap.
+        auto it = _regions.find(static_cast<char *>(p));
+        if (it != _regions.end())
+        {
+            _regions.erase(it);
+            lock.unlock();
+#if !defined(_WIN32)
+            munmap(p, size);
+#endif
+            return;
+        }
+    }
+
+    ::operator delete(p, std::align_val_t(alignment));
+}
+
+void *MappedStorage::_Map(size_t size)
+{
+#if defined(_WIN32)
+    return nullptr;
+#else
+    std::string path = _directory + "/hdTemplate-XXXXXX";
+    const int fd = mkstemp(&path[0]);
+    if (fd < 0)
+        return nullptr;
+
+    // The mapping keeps the file alive without a name, so it's gone as soon
+    // as it's unmapped, even if the process dies.
+    unlink(path.c_str());
+
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+    {
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return nullptr;
+
+    // Traversal jumps around the nodes and triangles, so reading ahead would
+    // mostly bring in pages nobody asked for.
+    madvise(p, size, MADV_RANDOM);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _regions.emplace(static_cast<char *>(p), size);
+
+    return p;
+#endif
+}
+
+void MappedStorage::Trim()
+{
+#if !defined(_WIN32)
+    if (!IsEnabled() || _residentBudget == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_regions.empty())
+        return;
+
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+    uint64_t residentSize = 0;
+    for (const auto &region : _regions)
+    {
+        residentSize += GetResidentSize(region.first, region.second, pageSize, _residency);
+    }
+
+    auto it = _regions.upper_bound(_trimPosition);
+    for (size_t i = 0; i < _regions.size() && residentSize > _residentBudget; ++i, ++it)
+    {
+        if (it == _regions.end())
+            it = _regions.begin();
+
+        const uint64_t regionSize = GetResidentSize(it->first, it->second, pageSize, _residency);
+        if (regionSize == 0)
+            continue;
+
+        PageOut(it->first, it->second);
+        residentSize -= std::min(residentSize, regionSize);
+        _trimPosition = it->first;
+    }
+#endif
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
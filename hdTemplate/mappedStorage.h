@@ -0,0 +1,101 @@
+#pragma once
+
+#include "pxr/pxr.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Backing store for the geometry that is traced: triangle records and wide
+// BVH nodes. Normally that is just the heap. With HDTEMPLATE_OUT_OF_CORE_DIR
+// naming a directory, large allocations are instead memory mapped from
+// temporary files there, which lets the OS page them out under memory
+// pressure and back in on demand rather than run out of memory.
+//
+// HDTEMPLATE_OUT_OF_CORE_RESIDENT_MB additionally caps how much of the mapped
+// data stays resident. The renderer calls Trim between samples to push pages
+// out past that budget.
+class MappedStorage final {
+    public:
+        // Smaller allocations stay on the heap, so that small meshes and
+        // scratch vectors don't each cost a file and a mapping.
+        static constexpr size_t MinMappedSize = size_t(1) << 20;
+
+        static MappedStorage &GetInstance();
+
+        bool IsEnabled() const {
+            return !_directory.empty();
+        }
+
+        void *Allocate(size_t size, size_t alignment);
+
+        // size and alignment have to match the Allocate call.
+        void Deallocate(void *p, size_t size, size_t alignment);
+
+        // Page out mapped data until no more than the resident budget is
+        // left in memory. Pages are taken from one allocation after another,
+        // carrying on where the last call stopped, so every allocation gets
+        // its turn. Paged out data is read back from its file when touched
+        // again, so this is safe at any time, though it's meant for when
+        // nothing is being traced.
+        void Trim();
+
+    private:
+        MappedStorage();
+
+        // Map size bytes from a new, already unlinked file in _directory.
+        // Returns null on failure.
+        void *_Map(size_t size);
+
+        std::string _directory;
+        uint64_t _residentBudget = 0;
+
+        // Guards the mapped allocations and the position of Trim.
+        std::mutex _mutex;
+        // Size of each mapped allocation, by address.
+        std::map<char *, size_t> _regions;
+        // Trim resumes with the first allocation past this address.
+        char *_trimPosition = nullptr;
+        // Scratch for the residency of each page of an allocation.
+        std::vector<unsigned char> _residency;
+};
+
+// Allocator of std::vector for data that may live in MappedStorage.
+template <class T>
+struct MappedAllocator {
+    typedef T value_type;
+
+    MappedAllocator() = default;
+
+    template <class U>
+    MappedAllocator(const MappedAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(MappedStorage::GetInstance().Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        MappedStorage::GetInstance().Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    template <class U>
+    bool operator==(const MappedAllocator<U> &) const {
+        return true;
+    }
+
+    template <class U>
+    bool operator!=(const MappedAllocator<U> &) const {
+        return false;
+    }
+};
+
+template <class T>
+using MappedVector = std::vector<T, MappedAllocator<T>>;
+
+PXR_NAMESPACE_CLOSE_SCOPE
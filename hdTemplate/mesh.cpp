@@ -11,25 +11,44 @@
 #include "pxr/base/gf/range3d.h"
 #include <iostream>
 
+#include "instancer.h"
 #include "sceneData.h"
+#include "triangleKernel.h"
 
 #include <algorithm> // sort
 
 PXR_NAMESPACE_OPEN_SCOPE
 
-static GfVec3f Cross(GfVec3f a, GfVec3f b)
+// Whether mesh BVHs wait for the first ray to reach the mesh, rather than
+// being built on a task started by Sync. Set by the build
+// (HDTEMPLATE_LAZY_BVH in CMake).
+#ifndef HDTEMPLATE_LAZY_BVH
+#define HDTEMPLATE_LAZY_BVH 0
+#endif
+
+HdTemplateMesh::HdTemplateMesh(SdfPath const &id) : HdMesh(id)
 {
-    return GfVec3f(
-               a[1] * b[2] - a[2] * b[1],
-               a[2] * b[0] - a[0] * b[2],
-               a[0] * b[1] - a[1] * b[0])
-        .GetNormalized();
+    _SetTransforms(GfMatrix4f(1.0f), VtMatrix4dArray());
 }
 
-HdTemplateMesh::HdTemplateMesh(SdfPath const &id) : HdMesh(id) {}
-
 void HdTemplateMesh::Finalize(HdRenderParam *renderParam)
 {
+    // The render thread may be tracing this mesh, and the top level still
+    // holds it. Stop it; the render delegate counts the mesh as destroyed,
+    // so the render pass gathers the scene again without it before resuming.
+    static_cast<HdTemplateRenderParam *>(renderParam)->AcquireSceneForEdit();
+
+    // Geometry shared with other meshes stays for them; otherwise this waits
+    // for its builds and frees it.
+    _geometry.reset();
+}
+
+void HdTemplateMesh::WaitForBVH()
+{
+    if (_geometry)
+    {
+        _geometry->WaitForBuild();
+    }
 }
 
 bool HdTemplateMesh::IntersectBBox(GfRay ray) const
@@ -37,35 +56,87 @@ bool HdTemplateMesh::IntersectBBox(GfRay ray) const
     return ray.Intersect(_bbox);
 }
 
-IntersectData HdTemplateMesh::Intersect(GfRay ray) const
+GfRange3d HdTemplateMesh::GetWorldBounds(size_t instance) const
+{
+    return GfBBox3d(_bbox.GetRange(), GfMatrix4d(_instances[instance].transform)).ComputeAlignedRange();
+}
+
+BVHRay HdTemplateMesh::_ToObjectSpace(const _Instance &instance, const BVHRay &ray)
+{
+    const GfVec3f direction = instance.inverseTransform.TransformDir(ray.direction);
+    return BVHRay(instance.inverseTransform.Transform(ray.origin),
+                  direction,
+                  GfVec3f(1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]),
+                  ray.tMin, ray.tMax);
+}
+
+void HdTemplateMesh::_SetTransforms(const GfMatrix4f &transform,
+                                    const VtMatrix4dArray &instanceTransforms)
+{
+    _transform = transform;
+    _bbox.SetMatrix(GfMatrix4d(transform));
+
+    auto addInstance = [this](const GfMatrix4f &instanceTransform)
+    {
+        // Instances flattened by their transform have no inverse and
+        // can't be hit.
+        double det = 0.0;
+        const GfMatrix4f inverse = instanceTransform.GetInverse(&det);
+        if (det != 0.0)
+        {
+            _instances.push_back(_Instance{instanceTransform, inverse});
+        }
+    };
+
+    _instances.clear();
+    if (GetInstancerId().IsEmpty())
+    {
+        addInstance(transform);
+    }
+    else
+    {
+        _instances.reserve(instanceTransforms.size());
+        for (const GfMatrix4d &instanceTransform : instanceTransforms)
+        {
+            addInstance(GfMatrix4f(GfMatrix4d(transform) * instanceTransform));
+        }
+    }
+}
+
+IntersectData HdTemplateMesh::Intersect(GfRay ray, float tMax, size_t instance) const
 {
     double closestT = std::numeric_limits<double>::infinity(); // Initialize closest intersection as infinite4
     GfVec3f normal(0.0f);
 
-    // Iterate over all triangles in the mesh
-    for (size_t i = 0; i < _triangulatedIndices.size(); i += 1)
+    const MeshGeometry &geometry = *_geometry;
+    geometry.EnsureBVH();
+
+    const _Instance &placement = _instances[instance];
+    BVHRay bvhRay = _ToObjectSpace(placement, BVHRay(ray, 0.0001f, tMax));
+    size_t closestTriangle = 0;
+
+    const TriangleKernel &kernel = GetTriangleKernel();
+
+    // Only test the triangles in the BVH leaves the ray passes through. The
+    // records are in leaf order, so each leaf is a straight run of them that
+    // the kernel tests several at a time.
+    geometry.GetWideBVH().Traverse(bvhRay, [&](uint32_t first, uint32_t count)
     {
-        // Extract triangle vertices
-        GfVec3f p0 = _transform.Transform(_points[_triangulatedIndices[i][0]]);
-        GfVec3f p1 = _transform.Transform(_points[_triangulatedIndices[i][1]]);
-        GfVec3f p2 = _transform.Transform(_points[_triangulatedIndices[i][2]]);
-
-        // Calculate intersection with the triangle using Möller-Trumbore algorithm
-        double t; // Store intersection distance as a double
-        GfVec3d barycentricCoords;
-        bool frontFacing;
-        bool hit = ray.Intersect(p0, p1, p2, &t, &barycentricCoords, &frontFacing);
-
-        // If the intersection is closer than the previous one, update closestT
-        if (hit && t > 0.0001f && t < closestT)
+        float t;
+        uint32_t index;
+        if (kernel.intersect(geometry.GetTriangles(), first, count, bvhRay, &t, &index))
         {
-            normal = Cross(p2 - p1, p2 - p0);
-            if (frontFacing)
-            {
-                normal *= -1;
-            }
-            closestT = t; // Convert the result back to float
+            closestT = t;
+            closestTriangle = index;
+
+            // Nodes further away than this hit can be skipped
+            bvhRay.tMax = t;
         }
+    });
+
+    if (closestT < std::numeric_limits<double>::infinity())
+    {
+        normal = _ToWorldNormal(placement, geometry.GetTriangles().GetNormal(closestTriangle, bvhRay.direction));
     }
 
     // Return the closest intersection t-value (or -1.0 if no intersection)
@@ -82,17 +153,82 @@ IntersectData HdTemplateMesh::Intersect(GfRay ray) const
 
     else
     {
-        GfVec3f Cd(1.0f);
+        return IntersectData{
+            closestT,
+            normal,
+            _displayColor};
+    }
+}
+
+bool HdTemplateMesh::Occluded(const BVHRay &ray, size_t instance) const
+{
+    const MeshGeometry &geometry = *_geometry;
+    geometry.EnsureBVH();
+
+    const TriangleKernel &kernel = GetTriangleKernel();
+    const BVHRay objectRay = _ToObjectSpace(_instances[instance], ray);
 
-        if (_colors.size() > 0)
+    return geometry.GetWideBVH().TraverseAny(objectRay, [&](uint32_t first, uint32_t count)
+    {
+        return kernel.occluded(geometry.GetTriangles(), first, count, objectRay);
+    });
+}
+
+void HdTemplateMesh::IntersectPacket(BVHRayPacket &packet, uint32_t activeMask,
+                                     IntersectData *hits, size_t instance) const
+{
+    const MeshGeometry &geometry = *_geometry;
+    geometry.EnsureBVH();
+
+    const TriangleKernel &kernel = GetTriangleKernel();
+    const _Instance &placement = _instances[instance];
+
+    // A linear transform keeps the rays of a coherent packet coherent, so
+    // the whole packet moves into object space together.
+    BVHRayPacket objectPacket;
+    for (uint32_t mask = activeMask; mask; mask &= mask - 1)
+    {
+        const int lane = WideBVHLowestBit(mask);
+        objectPacket.Set(lane, _ToObjectSpace(placement, packet.GetRay(lane)));
+    }
+
+    uint32_t closestTriangle[RayPacketSize];
+    uint32_t hitMask = 0;
+
+    // The packet goes down the BVH together; leaves are still tested one ray
+    // at a time since the kernels are wide across triangles.
+    geometry.GetWideBVH().TraversePacket(objectPacket, activeMask, [&](uint32_t first, uint32_t count, uint32_t laneMask)
+    {
+        for (; laneMask; laneMask &= laneMask - 1)
         {
-            Cd = _colors[0];
+            const int lane = WideBVHLowestBit(laneMask);
+            const BVHRay ray = objectPacket.GetRay(lane);
+
+            float t;
+            uint32_t index;
+            if (kernel.intersect(geometry.GetTriangles(), first, count, ray, &t, &index))
+            {
+                closestTriangle[lane] = index;
+                hitMask |= 1u << lane;
+
+                objectPacket.tMax[lane] = t;
+                packet.tMax[lane] = t;
+            }
         }
+    });
 
-        return IntersectData{
-            closestT,
-            normal,
-            Cd};
+    if (hitMask == 0)
+        return;
+
+    for (; hitMask; hitMask &= hitMask - 1)
+    {
+        const int lane = WideBVHLowestBit(hitMask);
+        const GfVec3f direction(objectPacket.direction[0][lane], objectPacket.direction[1][lane], objectPacket.direction[2][lane]);
+
+        hits[lane] = IntersectData{
+            packet.tMax[lane],
+            _ToWorldNormal(placement, geometry.GetTriangles().GetNormal(closestTriangle[lane], direction)),
+            _displayColor};
     }
 }
 
@@ -102,7 +238,7 @@ HdTemplateMesh::GetInitialDirtyBitsMask() const
     // The initial dirty bits control what data is available on the first
     // run through _PopulateRtMesh(), so it should list every data item
     // that _PopulateRtMesh requests.
-    int mask = HdChangeTracker::Clean | HdChangeTracker::InitRepr | HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyTopology | HdChangeTracker::DirtyTransform | HdChangeTracker::DirtyVisibility | HdChangeTracker::DirtyCullStyle | HdChangeTracker::DirtyDoubleSided | HdChangeTracker::DirtyDisplayStyle | HdChangeTracker::DirtySubdivTags | HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyNormals | HdChangeTracker::DirtyInstancer;
+    int mask = HdChangeTracker::Clean | HdChangeTracker::InitRepr | HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyTopology | HdChangeTracker::DirtyTransform | HdChangeTracker::DirtyVisibility | HdChangeTracker::DirtyRenderTag | HdChangeTracker::DirtyCullStyle | HdChangeTracker::DirtyDoubleSided | HdChangeTracker::DirtyDisplayStyle | HdChangeTracker::DirtySubdivTags | HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyNormals | HdChangeTracker::DirtyInstancer | HdChangeTracker::DirtyInstanceIndex;
 
     return (HdDirtyBits)mask;
 }
@@ -140,6 +276,33 @@ void HdTemplateMesh::Sync(HdSceneDelegate *sceneDelegate,
 
     SdfPath const &id = GetId();
 
+    // Instancer changes move the instances of a prototype around, the same
+    // as a new transform.
+    const bool placementDirty =
+        HdChangeTracker::IsTransformDirty(*dirtyBits, id) ||
+        HdChangeTracker::IsInstancerDirty(*dirtyBits, id) ||
+        HdChangeTracker::IsInstanceIndexDirty(*dirtyBits, id);
+
+    const bool geometryDirty =
+        HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points) ||
+        HdChangeTracker::IsTopologyDirty(*dirtyBits, id) ||
+        placementDirty;
+
+    // Whether the mesh may join or leave the scene's top level, which only
+    // holds visible meshes with a render tag being rendered.
+    const bool filterDirty =
+        HdChangeTracker::IsVisibilityDirty(*dirtyBits, id) ||
+        (*dirtyBits & HdChangeTracker::DirtyRenderTag) != 0;
+
+    if (geometryDirty || filterDirty)
+    {
+        // The geometry the render thread traces is about to change, so stop
+        // it before touching anything it reads, since that includes the
+        // points and triangles of meshes it hasn't built a BVH for yet. This
+        // also lets the render pass know it has to rebuild the scene.
+        static_cast<HdTemplateRenderParam *>(renderParam)->AcquireSceneForEdit();
+    }
+
     TfTokenVector computedPrimvars = _UpdateComputedPrimvarSources(sceneDelegate, *dirtyBits);
 
     bool pointsIsComputed =
@@ -151,100 +314,150 @@ void HdTemplateMesh::Sync(HdSceneDelegate *sceneDelegate,
     {
         VtValue value = sceneDelegate->Get(id, HdTokens->points);
         _points = value.Get<VtVec3fArray>();
+        _pointsComputed = false;
     }
 
-    if (HdChangeTracker::IsTopologyDirty(*dirtyBits, id))
-    {
-        // When pulling a new topology, we don't want to overwrite the
-        // refine level or subdiv tags, which are provided separately by the
-        // scene delegate, so we save and restore them.
-        PxOsdSubdivTags subdivTags = _topology.GetSubdivTags();
-        int refineLevel = _topology.GetRefineLevel();
-        _topology = HdMeshTopology(GetMeshTopology(sceneDelegate), refineLevel);
-        _topology.SetSubdivTags(subdivTags);
-    }
-    if (HdChangeTracker::IsSubdivTagsDirty(*dirtyBits, id) &&
-        _topology.GetRefineLevel() > 0)
+    if (HdChangeTracker::IsVisibilityDirty(*dirtyBits, id))
     {
-        _topology.SetSubdivTags(sceneDelegate->GetSubdivTags(id));
+        _UpdateVisibility(sceneDelegate, dirtyBits);
     }
 
-    if (HdChangeTracker::IsTransformDirty(*dirtyBits, id))
+    // Only the triangles are traced, so the topology is let go of as soon
+    // as it's triangulated. Subdivision isn't traced, so neither are the
+    // refine level and subdiv tags kept.
+    VtVec3iArray triangulatedIndices;
+    if (HdChangeTracker::IsTopologyDirty(*dirtyBits, id))
     {
-        _transform = GfMatrix4f(sceneDelegate->GetTransform(id));
+        HdMeshTopology topology = GetMeshTopology(sceneDelegate);
+        VtIntArray primitiveParams;
+        HdMeshUtil meshUtil(&topology, GetId());
+        meshUtil.ComputeTriangleIndices(&triangulatedIndices, &primitiveParams);
     }
 
-    if (HdChangeTracker::IsVisibilityDirty(*dirtyBits, id))
-    {
-        _UpdateVisibility(sceneDelegate, dirtyBits);
-    }
+    // The instancer, and any it is nested in, have to be synced before
+    // they're asked for instance transforms.
+    _UpdateInstancer(sceneDelegate, dirtyBits);
+    HdInstancer::_SyncInstancerAndParents(sceneDelegate->GetRenderIndex(), GetInstancerId());
 
-    HdMeshUtil meshUtil(&_topology, GetId());
-    meshUtil.ComputeTriangleIndices(&_triangulatedIndices,
-                                    &_trianglePrimitiveParams);
+    if (placementDirty)
+    {
+        GfMatrix4f transform = _transform;
+        if (HdChangeTracker::IsTransformDirty(*dirtyBits, id))
+        {
+            transform = GfMatrix4f(sceneDelegate->GetTransform(id));
+        }
 
-    // Assuming you have a sceneDelegate and an id for the object you're querying
+        VtMatrix4dArray instanceTransforms;
+        if (HdInstancer *instancer = sceneDelegate->GetRenderIndex().GetInstancer(GetInstancerId()))
+        {
+            instanceTransforms = static_cast<HdTemplateInstancer *>(instancer)->ComputeInstanceTransforms(id);
+        }
 
-    VtValue value = sceneDelegate->Get(id, HdTokens->bbox);
-    if (value.IsHolding<GfBBox3d>())
-    {
-        _bbox = value.Get<GfBBox3d>();
+        _SetTransforms(transform, instanceTransforms);
     }
-    else
-    {
-        _bbox = GfBBox3d();
 
-        if (!_points.empty())
+    // Moving a mesh only changes its entries in the scene's top level BVH;
+    // its own BVH is in object space and stays as it is.
+    if (HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points) ||
+        HdChangeTracker::IsTopologyDirty(*dirtyBits, id))
+    {
+        // The mesh keeps no points or triangles of its own, so whichever of
+        // them didn't change comes back out of its current geometry.
+        // Points pulled from the scene delegate are pulled again instead,
+        // since the geometry may only hold quantized ones.
+        if (!HdChangeTracker::IsTopologyDirty(*dirtyBits, id) && _geometry)
         {
-            GfRange3d range;
-
-            for (const GfVec3f &point : _points)
+            triangulatedIndices = _geometry->GetMesh().DecodeTriangles();
+        }
+        if (!HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points))
+        {
+            if (!_pointsComputed)
             {
-                range.UnionWith(_transform.Transform(GfVec3d(point)));
+                _points = sceneDelegate->Get(id, HdTokens->points).Get<VtVec3fArray>();
+            }
+            else if (_geometry)
+            {
+                _points = _geometry->GetMesh().DecodePoints();
             }
-
-            _bbox.SetRange(range);
         }
+
+        // Deforming meshes keep their triangles, so their tree only needs
+        // its bounds refreshed.
+        _UpdateGeometry(static_cast<HdTemplateRenderParam *>(renderParam)->GetMeshGeometryRegistry(),
+                        triangulatedIndices,
+                        !HdChangeTracker::IsTopologyDirty(*dirtyBits, id));
+
+#if !HDTEMPLATE_LAZY_BVH
+        // Build while Hydra syncs the other prims. The render pass waits
+        // for it before the scene's top level is built. Geometry shared
+        // with a mesh synced earlier is already being built.
+        _geometry->StartBuild();
+#endif
     }
 
+    // Meshes are shaded with their first display color, so that's all
+    // that is kept.
     VtValue Cd = sceneDelegate->Get(id, HdTokens->displayColor);
     if (Cd.IsHolding<VtVec3fArray>()) {
-        _colors = Cd.Get<VtVec3fArray>();
+        const VtVec3fArray &colors = Cd.UncheckedGet<VtVec3fArray>();
+        _displayColor = colors.empty() ? GfVec3f(1.0f) : colors[0];
     }
+
+    *dirtyBits &= ~HdChangeTracker::AllSceneDirtyBits;
 }
 
-void HdTemplateMesh::_UpdatePrimvarSources(HdSceneDelegate *sceneDelegate,
-                                           HdDirtyBits dirtyBits)
+void HdTemplateMesh::_UpdateGeometry(MeshGeometryRegistry &registry,
+                                     const VtVec3iArray &triangulatedIndices,
+                                     bool refit)
 {
     HD_TRACE_FUNCTION();
-    SdfPath const &id = GetId();
 
-    // Update _primvarSourceMap, our local cache of raw primvar data.
-    // This function pulls data from the scene delegate, but defers processing.
-    //
-    // While iterating primvars, we skip "points" (vertex positions) because
-    // the points primvar is processed by _PopulateRtMesh. We only call
-    // GetPrimvar on primvars that have been marked dirty.
-    //
-    // Currently, hydra doesn't have a good way of communicating changes in
-    // the set of primvars, so we only ever add and update to the primvar set.
-
-    HdPrimvarDescriptorVector primvars;
-    for (size_t i = 0; i < HdInterpolationCount; ++i)
+    std::shared_ptr<const MeshGeometry> refitSource;
+    if (refit)
     {
-        HdInterpolation interp = static_cast<HdInterpolation>(i);
-        primvars = GetPrimvarDescriptors(sceneDelegate, interp);
-        for (HdPrimvarDescriptor const &pv : primvars)
-        {
-            if (HdChangeTracker::IsPrimvarDirty(dirtyBits, id, pv.name) &&
-                pv.name != HdTokens->points)
-            {
-                _primvarSourceMap[pv.name] = {
-                    GetPrimvar(sceneDelegate, pv.name),
-                    interp};
-            }
-        }
+        refitSource = _geometry;
     }
+
+    // Meshes with the same points and triangles get the same geometry, so
+    // only the first of them has its BVH built. Letting go of the old
+    // geometry frees it once no other mesh uses it.
+    _geometry = registry.Acquire(_points, triangulatedIndices, std::move(refitSource));
+
+    // The geometry has its own compact copy of the points.
+    _points = VtVec3fArray();
+
+    if (!_geometry->IsValid())
+    {
+        // Points and topology are out of sync, e.g. mid edit, so the mesh
+        // is left untraceable until they agree again.
+        TF_WARN("Mesh %s has triangle indices outside its points",
+                GetId().GetText());
+    }
+
+    // The BVH itself may be left for the first ray that reaches the mesh,
+    // but the scene's top level needs the bounds now.
+    _bbox.SetRange(_geometry->GetBounds());
+}
+
+bool HdTemplateMesh::ApplyRefinedBVH()
+{
+    if (!_geometry)
+        return false;
+
+    // The refined geometry has the same bounds, so the mesh's bbox and the
+    // scene's top level stay valid. Other meshes sharing the old geometry,
+    // in this render delegate or another, move on in their own time.
+    std::shared_ptr<MeshGeometry> refined = _geometry->GetRefined();
+    if (!refined)
+        return false;
+
+    _geometry = std::move(refined);
+    return true;
+}
+
+BVHStats HdTemplateMesh::GetBVHStats() const
+{
+    return _geometry ? _geometry->GetBVHStats() : BVHStats();
 }
 
 TfTokenVector
@@ -290,15 +503,12 @@ HdTemplateMesh::_UpdateComputedPrimvarSources(HdSceneDelegate *sceneDelegate,
             continue;
         }
 
+        // Only points are traced; other primvars aren't kept.
         compPrimvarNames.emplace_back(compPrimvar.name);
         if (compPrimvar.name == HdTokens->points)
         {
             _points = it->second.Get<VtVec3fArray>();
-        }
-        else
-        {
-            _primvarSourceMap[compPrimvar.name] = {it->second,
-                                                   compPrimvar.interpolation};
+            _pointsComputed = true;
         }
     }
 
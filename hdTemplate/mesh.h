@@ -8,8 +8,16 @@
 #include "pxr/base/gf/matrix4f.h"
 #include "pxr/base/gf/matrix3f.h"
 #include "pxr/base/gf/vec2f.h"
+#include "pxr/base/work/dispatcher.h"
 #include "pxr/base/work/loops.h"
 #include "pxr/base/gf/ray.h"
+#include "pxr/base/vt/types.h"
+
+#include "bvh.h"
+#include "meshGeometry.h"
+
+#include <memory>
+#include <vector>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -38,7 +46,27 @@ public:
 
     virtual void Finalize(HdRenderParam *renderParam) override;
 
-    IntersectData Intersect(GfRay ray) const;
+    // Number of places the mesh appears in the world: one unless it's a
+    // prototype of an instancer. Every instance traces the same object
+    // space BVH and triangles. Instances whose transform flattens the mesh
+    // can't be hit and are left out.
+    size_t GetInstanceCount() const {
+        return _instances.size();
+    }
+
+    // Closest hit nearer than tMax, or t of -1 if there is none. Passing
+    // the closest hit found so far as tMax prunes the traversal with it.
+    IntersectData Intersect(GfRay ray, float tMax, size_t instance) const;
+
+    // Whether any triangle is hit inside [ray.tMin, ray.tMax]. Returns on
+    // the first hit found and computes no shading data.
+    bool Occluded(const BVHRay &ray, size_t instance) const;
+
+    // Closest hits for the lanes of a packet in activeMask. Lanes that hit
+    // this mesh nearer than their packet.tMax get it shortened to the hit
+    // and hits[lane] overwritten.
+    void IntersectPacket(BVHRayPacket &packet, uint32_t activeMask,
+                         IntersectData *hits, size_t instance) const;
 
     bool IntersectBBox(GfRay ray) const;
 
@@ -46,39 +74,93 @@ public:
         return _transform;
     }
 
+    // Object space bounds of the triangles along with the transform.
     GfBBox3d GetBBox() const {
         return _bbox;
     }
 
+    // World space bounds of one instance.
+    GfRange3d GetWorldBounds(size_t instance) const;
+
+    // Swap in the SAH BVH that was being built in the background, if it is
+    // done. This replaces the geometry, so nothing may trace the mesh or
+    // read its geometry or stats meanwhile: the render thread does it
+    // between samples, and other threads only see stats it snapshots then
+    // (see HdTemplateRenderer::GetBVHStats). Returns whether the BVH changed.
+    bool ApplyRefinedBVH();
+
+    // Wait for the BVH build started by the last Sync, if any.
+    void WaitForBVH();
+
+    // Statistics of the BVH currently traced, with the wide layout and the
+    // triangle records counted in its memory. Empty while the BVH isn't
+    // built. Must not overlap with Sync, nor with tracing, which may call
+    // ApplyRefinedBVH.
+    BVHStats GetBVHStats() const;
+
+    // The triangles and BVH the mesh traces, possibly shared with other
+    // meshes that have the same points and topology. Null before the first
+    // Sync.
+    const MeshGeometry *GetGeometry() const {
+        return _geometry.get();
+    }
+
 protected:
     virtual void _InitRepr(TfToken const &reprToken, HdDirtyBits *dirtyBits) override;
 
     virtual HdDirtyBits _PropagateDirtyBits(HdDirtyBits bits) const override;
 
 private:
-    void _UpdatePrimvarSources(HdSceneDelegate *sceneDelegate,
-                               HdDirtyBits dirtyBits);
-
-    // Populate _primvarSourceMap with primvars that are computed.
+    // Pull the primvars that are computed, taking the points into _points.
     // Return the names of the primvars that were successfully updated.
     TfTokenVector _UpdateComputedPrimvarSources(HdSceneDelegate *sceneDelegate,
                                                 HdDirtyBits dirtyBits);
 
-    HdMeshTopology _topology;
+    // Take on new points or triangles: move on to the geometry of _points
+    // and triangulatedIndices from registry, release _points and update the
+    // object space bounds. With refit set the triangulation is known to be
+    // unchanged, so a new geometry may refit the BVH of the current one
+    // rather than build again.
+    void _UpdateGeometry(MeshGeometryRegistry &registry,
+                         const VtVec3iArray &triangulatedIndices,
+                         bool refit);
+
+    // One placement of the object space triangles in the world.
+    struct _Instance
+    {
+        GfMatrix4f transform;
+        GfMatrix4f inverseTransform;
+    };
+
+    // Place the mesh in the world: once by transform, or once per entry of
+    // instanceTransforms on top of it for a prototype. Its BVH and triangles
+    // stay in object space, so this leaves them alone.
+    void _SetTransforms(const GfMatrix4f &transform,
+                        const VtMatrix4dArray &instanceTransforms);
+
+    // Move a world space ray into the object space of an instance. The
+    // direction isn't renormalized, so distances along the ray are the same
+    // in both.
+    static BVHRay _ToObjectSpace(const _Instance &instance, const BVHRay &ray);
+
+    // The inverse transpose carries normals to world space.
+    static GfVec3f _ToWorldNormal(const _Instance &instance, const GfVec3f &normal) {
+        return instance.inverseTransform.GetTranspose().TransformDir(normal).GetNormalized();
+    }
+
     GfMatrix4f _transform;
-    VtVec3fArray _points;
-    VtVec3fArray _colors;
+    std::vector<_Instance> _instances;
+    GfVec3f _displayColor{1.0f};
     GfBBox3d _bbox;
 
-    VtVec3iArray _triangulatedIndices;
-    VtIntArray _trianglePrimitiveParams;
+    // Points pulled during Sync, until the geometry has taken them, and
+    // whether they were computed rather than pulled from the scene delegate.
+    VtVec3fArray _points;
+    bool _pointsComputed = false;
 
-    struct PrimvarSource
-    {
-        VtValue data;
-        HdInterpolation interpolation;
-    };
-    TfHashMap<TfToken, PrimvarSource, TfToken::HashFunctor> _primvarSourceMap;
+    // The points and triangles in compact form, with the BVH and triangle
+    // records over them, in object space.
+    std::shared_ptr<MeshGeometry> _geometry;
 
     HdTemplateMesh(const HdTemplateMesh &) = delete;
     HdTemplateMesh &operator=(const HdTemplateMesh &) = delete;
@@ -0,0 +1,400 @@
+#include "meshGeometry.h"
+
+#include "pxr/imaging/hd/perfLog.h"
+#include "pxr/base/tf/envSetting.h"
+#include "pxr/base/work/withScopedParallelism.h"
+
+#include "bvhCache.h"
+
+#include <algorithm>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Geometry with at least this many triangles is first given an LBVH, with
+// the SAH BVH built in the background. Smaller ones build an SAH BVH in about
+// the time it takes to start a task.
+static constexpr size_t LBVHMinTriangles = 1 << 16;
+
+TF_DEFINE_ENV_SETTING(HDTEMPLATE_QUANTIZE_POINTS, false,
+                      "Store mesh points as 16 bit steps within their bounds "
+                      "rather than as floats, and trace them as such.");
+
+MeshGeometry::MeshGeometry(std::shared_ptr<const CompactMesh> mesh,
+                           std::shared_ptr<const MeshGeometry> refitSource)
+    : _mesh(std::move(mesh))
+{
+    if (!_mesh->IsValid())
+    {
+        // Nothing to build, and nothing to hit.
+        _bvhReady.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    if (refitSource)
+    {
+        // A source that was never built is of no use, but may itself have a
+        // built one to refit from. Taking that over keeps meshes edited
+        // several times before they're traced from holding on to every
+        // geometry in between.
+        std::lock_guard<std::mutex> lock(refitSource->_bvhMutex);
+        if (refitSource->_bvhReady.load(std::memory_order_relaxed) ||
+            refitSource->_buildStarted.load(std::memory_order_relaxed))
+        {
+            _refitSource = std::move(refitSource);
+        }
+        else
+        {
+            _refitSource = refitSource->_refitSource;
+        }
+    }
+}
+
+MeshGeometry::MeshGeometry(const MeshGeometry &unrefined, std::nullptr_t)
+    : _registry(unrefined._registry)
+    , _key(unrefined._key)
+    , _mesh(unrefined._mesh)
+{
+}
+
+MeshGeometry::~MeshGeometry()
+{
+    // The dispatchers still wait for their tasks, but a refinement in
+    // progress now stops early and throws its BVH away.
+    _cancelRefine.store(true, std::memory_order_relaxed);
+}
+
+void MeshGeometry::StartBuild()
+{
+    if (_bvhReady.load(std::memory_order_acquire) ||
+        _buildStarted.exchange(true))
+        return;
+
+    _buildDispatcher.Run([this]()
+    {
+        EnsureBVH();
+    });
+}
+
+void MeshGeometry::WaitForBuild()
+{
+    // Rather than wait on the dispatcher, which only one thread may do at a
+    // time, join the build: this returns once it's done, or runs it here if
+    // the task hasn't started yet.
+    if (_buildStarted.load(std::memory_order_acquire))
+    {
+        EnsureBVH();
+    }
+}
+
+void MeshGeometry::EnsureBVH() const
+{
+    if (_bvhReady.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(_bvhMutex);
+    if (_bvhReady.load(std::memory_order_relaxed))
+        return;
+
+    // Isolate the build so that while this thread waits on its parallel
+    // parts it can't pick up a tile that traces this geometry and blocks on
+    // the lock it holds. Building the BVH doesn't change what the geometry
+    // looks like from the outside, hence the const_cast.
+    WorkWithScopedParallelism([this]()
+    {
+        const_cast<MeshGeometry *>(this)->_BuildBVH();
+    });
+
+    _bvhReady.store(true, std::memory_order_release);
+}
+
+void MeshGeometry::_BuildBVH()
+{
+    HD_TRACE_FUNCTION();
+
+    // The constructor has already checked the indices against the points.
+    const CompactMesh &mesh = *_mesh;
+    std::vector<BVHBounds> triangleBounds(mesh.GetNumTriangles());
+    for (size_t i = 0; i < triangleBounds.size(); ++i)
+    {
+        const GfVec3i triangle = mesh.GetTriangle(i);
+        for (int j = 0; j < 3; ++j)
+        {
+            triangleBounds[i].Grow(mesh.GetPoint(triangle[j]));
+        }
+    }
+
+    // The triangle kernels test several triangles per step, so leaves of
+    // just one or two would mostly leave SIMD lanes idle.
+    BVHBuildOptions options;
+    options.minLeafSize = 4;
+
+    // Moved points keep the triangles, so the tree over the old ones only
+    // needs its bounds refreshed, unless that leaves it much worse.
+    bool refit = false;
+    if (_refitSource)
+    {
+        _refitSource->EnsureBVH();
+
+        // An SAH tree the source's refinement has finished is the better
+        // one to refit.
+        std::shared_ptr<const MeshGeometry> source = _refitSource->GetRefined();
+        if (!source)
+        {
+            source = std::move(_refitSource);
+        }
+        _bvh = source->_bvh;
+        _lbvh = source->_lbvh;
+        _refitSource.reset();
+        source.reset();
+
+        refit = _bvh.Refit(triangleBounds);
+    }
+
+    // A refit LBVH is still refined, or it would never be once the mesh
+    // is animated.
+    bool refine = refit && _lbvh;
+    uint64_t cacheKey = 0;
+    BVHCache &cache = BVHCache::GetInstance();
+    if (cache.IsEnabled() && (!refit || refine))
+    {
+        cacheKey = BVHCache::ComputeKey(triangleBounds, options);
+    }
+
+    if (!refit)
+    {
+        // Geometry seen before, in this or an earlier session, can skip the
+        // SAH build altogether.
+        _lbvh = false;
+        if (!cache.Load(cacheKey, triangleBounds.size(), options, &_bvh))
+        {
+            // Big meshes start out with an LBVH so the first samples aren't
+            // held up by the SAH build, which follows in the background.
+            refine = triangleBounds.size() >= LBVHMinTriangles;
+            if (refine)
+            {
+                _bvh.BuildLBVH(triangleBounds, options);
+                _lbvh = true;
+            }
+            else
+            {
+                _bvh.Build(triangleBounds, options);
+                cache.Store(cacheKey, _bvh);
+            }
+        }
+    }
+    _wideBvh.Collapse(_bvh);
+
+    // Lay the triangle records out in the order the BVH leaves reference them.
+    // Quantized meshes keep their points quantized in the records too.
+    const std::vector<uint32_t> &primIndices = _bvh.GetPrimIndices();
+    if (mesh.IsQuantized())
+    {
+        _triangles.ResizeQuantized(primIndices.size(), mesh.GetOrigin(), mesh.GetStep());
+        for (size_t i = 0; i < primIndices.size(); ++i)
+        {
+            const GfVec3i triangle = mesh.GetTriangle(primIndices[i]);
+            _triangles.SetQuantized(i,
+                                    mesh.GetQuantizedPoint(triangle[0]),
+                                    mesh.GetQuantizedPoint(triangle[1]),
+                                    mesh.GetQuantizedPoint(triangle[2]));
+        }
+    }
+    else
+    {
+        _triangles.Resize(primIndices.size());
+        for (size_t i = 0; i < primIndices.size(); ++i)
+        {
+            const GfVec3i triangle = mesh.GetTriangle(primIndices[i]);
+            _triangles.Set(i,
+                           mesh.GetPoint(triangle[0]),
+                           mesh.GetPoint(triangle[1]),
+                           mesh.GetPoint(triangle[2]));
+        }
+    }
+
+    if (refine)
+    {
+        _StartRefinedBVH(std::move(triangleBounds), options, cacheKey);
+    }
+}
+
+void MeshGeometry::_StartRefinedBVH(std::vector<BVHBounds> triangleBounds,
+                                    const BVHBuildOptions &options, uint64_t cacheKey)
+{
+    _refineDispatcher.Run([this, triangleBounds = std::move(triangleBounds), options, cacheKey]()
+    {
+        HD_TRACE_SCOPE("MeshGeometry refined BVH build");
+
+        // Render delegates may be tracing this geometry as the SAH BVH is
+        // built, so it goes into a new one rather than replace this one's.
+        std::shared_ptr<MeshGeometry> refined(new MeshGeometry(*this, nullptr));
+
+        // Nothing is left to use the refinement of a geometry being
+        // destroyed.
+        if (!refined->_bvh.Build(triangleBounds, options, &_cancelRefine))
+            return;
+        BVHCache::GetInstance().Store(cacheKey, refined->_bvh);
+        refined->_wideBvh.Collapse(refined->_bvh);
+
+        // The records are copied from the ones of the LBVH, in the refined
+        // BVH's leaf order.
+        const std::vector<uint32_t> &tracedIndices = _bvh.GetPrimIndices();
+        std::vector<uint32_t> tracedRecord(tracedIndices.size());
+        for (size_t i = 0; i < tracedIndices.size(); ++i)
+        {
+            tracedRecord[tracedIndices[i]] = static_cast<uint32_t>(i);
+        }
+
+        const std::vector<uint32_t> &primIndices = refined->_bvh.GetPrimIndices();
+        if (_triangles.quantized)
+        {
+            refined->_triangles.ResizeQuantized(primIndices.size(), _triangles.origin, _triangles.step);
+        }
+        else
+        {
+            refined->_triangles.Resize(primIndices.size());
+        }
+        for (size_t i = 0; i < primIndices.size(); ++i)
+        {
+            refined->_triangles.Copy(i, _triangles, tracedRecord[primIndices[i]]);
+        }
+
+        refined->_buildStarted.store(true, std::memory_order_relaxed);
+        refined->_bvhReady.store(true, std::memory_order_release);
+
+        // Meshes synced from now on get the refined geometry directly, even
+        // after all meshes have moved on from this one.
+        if (_registry)
+        {
+            _registry->_Insert(_key, refined);
+        }
+
+        _refined = std::move(refined);
+        _refinedReady.store(true, std::memory_order_release);
+    });
+}
+
+BVHStats MeshGeometry::GetBVHStats() const
+{
+    // Building the BVH just to report on it would defeat
+    // HDTEMPLATE_LAZY_BVH.
+    if (!_bvhReady.load(std::memory_order_acquire))
+        return BVHStats();
+
+    std::lock_guard<std::mutex> lock(_bvhMutex);
+    if (!_bvhStatsValid)
+    {
+        _bvhStats = _bvh.ComputeStats();
+        _bvhStats.memorySize += _wideBvh.GetMemorySize() + _triangles.GetMemorySize() +
+                                _mesh->GetMemorySize();
+        _bvhStatsValid = true;
+    }
+    return _bvhStats;
+}
+
+std::shared_ptr<MeshGeometry>
+MeshGeometryRegistry::Acquire(const VtVec3fArray &points,
+                              const VtVec3iArray &indices,
+                              std::shared_ptr<const MeshGeometry> refitSource)
+{
+    HD_TRACE_FUNCTION();
+
+    auto mesh = std::make_shared<const CompactMesh>(
+        points, indices, TfGetEnvSetting(HDTEMPLATE_QUANTIZE_POINTS));
+    const uint64_t key = mesh->ComputeHash();
+
+    // Outlives the move into the new geometry below, which then owns it.
+    const CompactMesh &compactMesh = *mesh;
+
+    // Live geometries filed under key. Called with _mutex held; the caller
+    // releases them only once it's unlocked, since the last reference to a
+    // geometry waits for its refinement, which files itself under _mutex.
+    auto gather = [&](std::vector<std::shared_ptr<MeshGeometry>> *candidates)
+    {
+        auto range = _geometries.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (std::shared_ptr<MeshGeometry> geometry = it->second.lock())
+            {
+                candidates->push_back(std::move(geometry));
+            }
+        }
+    };
+
+    auto match = [&](const std::vector<std::shared_ptr<MeshGeometry>> &candidates)
+        -> std::shared_ptr<MeshGeometry>
+    {
+        for (const std::shared_ptr<MeshGeometry> &geometry : candidates)
+        {
+            if (geometry->GetMesh() == compactMesh)
+            {
+                if (std::shared_ptr<MeshGeometry> refined = geometry->GetRefined())
+                    return refined;
+                return geometry;
+            }
+        }
+        return nullptr;
+    };
+
+    // The first lookup compares outside the lock, since comparing big
+    // meshes takes a while and most meshes aren't shared.
+    {
+        std::vector<std::shared_ptr<MeshGeometry>> candidates;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            gather(&candidates);
+        }
+        if (std::shared_ptr<MeshGeometry> shared = match(candidates))
+            return shared;
+    }
+
+    // Not made with make_shared: the registry's weak references would keep
+    // the memory of the whole geometry around until the next collection.
+    std::shared_ptr<MeshGeometry> geometry(
+        new MeshGeometry(std::move(mesh), std::move(refitSource)));
+    geometry->_registry = this;
+    geometry->_key = key;
+
+    // Another Sync may have made the same geometry meanwhile. Looking again
+    // and filing this one under the same lock makes sure only one of them
+    // is kept; the other Sync's is shared and this one dropped.
+    std::vector<std::shared_ptr<MeshGeometry>> candidates;
+    std::lock_guard<std::mutex> lock(_mutex);
+    gather(&candidates);
+    if (std::shared_ptr<MeshGeometry> shared = match(candidates))
+        return shared;
+
+    _geometries.emplace(key, geometry);
+    return geometry;
+}
+
+void MeshGeometryRegistry::_Insert(uint64_t key, const std::shared_ptr<MeshGeometry> &geometry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _geometries.emplace(key, geometry);
+}
+
+void MeshGeometryRegistry::GarbageCollect()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _geometries.begin(); it != _geometries.end();)
+    {
+        if (it->second.expired())
+        {
+            it = _geometries.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+size_t MeshGeometryRegistry::GetGeometryCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return std::count_if(_geometries.begin(), _geometries.end(),
+                         [](const auto &entry) { return !entry.second.expired(); });
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/base/gf/range3d.h"
+#include "pxr/base/vt/types.h"
+#include "pxr/base/work/dispatcher.h"
+
+#include "bvh.h"
+#include "compactMesh.h"
+#include "wideBVH.h"
+#include "triangles.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+class MeshGeometryRegistry;
+
+// The object space triangles of a mesh, in compact form, and the BVH over
+// them: everything about a mesh that is traced, other than where it is
+// placed. Nothing about it changes once its BVH is built; a mesh whose
+// geometry changes moves on to another one, and so does a mesh whose BVH
+// has been refined. That lets
+// meshes with the same points and triangles share one through
+// MeshGeometryRegistry, even meshes of render delegates that trace them at
+// the same time.
+class MeshGeometry final {
+    public:
+        // refitSource, if given, is an earlier geometry with the same
+        // triangles over other points, whose BVH the build refits instead of
+        // building one from scratch.
+        MeshGeometry(std::shared_ptr<const CompactMesh> mesh,
+                     std::shared_ptr<const MeshGeometry> refitSource);
+
+        ~MeshGeometry();
+
+        // The points and triangles the BVH and triangle records are built
+        // from.
+        const CompactMesh &GetMesh() const {
+            return *_mesh;
+        }
+
+        // Whether every triangle indexes one of the points. Invalid geometry
+        // has empty bounds and nothing to hit.
+        bool IsValid() const {
+            return _mesh->IsValid();
+        }
+
+        // A tight bound of every triangle, which is also what the root of
+        // the BVH will be.
+        const GfRange3d &GetBounds() const {
+            return _mesh->GetBounds();
+        }
+
+        // Start building the BVH on a task, unless that has been done
+        // already.
+        void StartBuild();
+
+        // Wait for the build started by StartBuild, if any. May be called by
+        // several render passes at once.
+        void WaitForBuild();
+
+        // Build the BVH and triangle records if they aren't yet, once, with
+        // any other callers waiting for it meanwhile. Called by the build
+        // task, and by every trace in case nothing started one.
+        void EnsureBVH() const;
+
+        const RenderBVH &GetWideBVH() const {
+            return _wideBvh;
+        }
+
+        const TriangleRecords &GetTriangles() const {
+            return _triangles;
+        }
+
+        // The same geometry with the SAH BVH that was being built in the
+        // background, once that is done, for meshes to move on to between
+        // samples. Null until then.
+        std::shared_ptr<MeshGeometry> GetRefined() const {
+            return _refinedReady.load(std::memory_order_acquire) ? _refined : nullptr;
+        }
+
+        // Statistics of the BVH currently traced, with the wide layout, the
+        // triangle records and the compact mesh counted in its memory. Empty
+        // while the BVH isn't built.
+        BVHStats GetBVHStats() const;
+
+    private:
+        friend class MeshGeometryRegistry;
+
+        // The same mesh as unrefined, for its refinement to build a BVH
+        // over.
+        MeshGeometry(const MeshGeometry &unrefined, std::nullptr_t);
+
+        void _BuildBVH();
+
+        // Build an SAH BVH over triangleBounds into a new geometry on a
+        // background task, to replace this one with its LBVH, and store it
+        // in the BVH cache under cacheKey.
+        void _StartRefinedBVH(std::vector<BVHBounds> triangleBounds,
+                              const BVHBuildOptions &options, uint64_t cacheKey);
+
+        // The registry that made this, and the key it's filed under there.
+        MeshGeometryRegistry *_registry = nullptr;
+        uint64_t _key = 0;
+
+        // Shared with the refined geometry, if any.
+        const std::shared_ptr<const CompactMesh> _mesh;
+
+        // Dropped once the build has used it.
+        std::shared_ptr<const MeshGeometry> _refitSource;
+
+        // BVH over _mesh, its wide layout that is actually traversed,
+        // and copies of the triangles in its leaf order, quantized if
+        // _mesh is.
+        BVH _bvh;
+        RenderBVH _wideBvh;
+        TriangleRecords _triangles;
+
+        // Whether _bvh is an LBVH, or refit from one, still to be refined.
+        bool _lbvh = false;
+
+        // Whether _bvh, _wideBvh and _triangles are built, and whether
+        // StartBuild has been called. Building is all that writes to them.
+        mutable std::atomic<bool> _bvhReady{false};
+        std::atomic<bool> _buildStarted{false};
+        mutable std::mutex _bvhMutex;
+
+        // GetBVHStats of the current BVH, computed on first request.
+        // Guarded by _bvhMutex.
+        mutable BVHStats _bvhStats;
+        mutable bool _bvhStatsValid = false;
+
+        // Result of the background SAH build, and whether it has finished.
+        std::shared_ptr<MeshGeometry> _refined;
+        std::atomic<bool> _refinedReady{false};
+
+        // Set on destruction, for the background SAH build to give up rather
+        // than hold the destructor up until it's done.
+        std::atomic<bool> _cancelRefine{false};
+
+        // Run the background SAH build and the build started by StartBuild.
+        // Declared last so they're destroyed first, waiting for their tasks
+        // before the members those write go away. The build task may start
+        // a refinement, so it goes before that.
+        WorkDispatcher _refineDispatcher;
+        WorkDispatcher _buildDispatcher;
+
+        MeshGeometry(const MeshGeometry &) = delete;
+        MeshGeometry &operator=(const MeshGeometry &) = delete;
+};
+
+// Hands out one MeshGeometry per distinct set of points and triangles, so
+// that meshes which are copies of each other without being authored as
+// instances, such as repeated bolts or tiles, keep one BVH and one set of
+// triangle records between them.
+//
+// Meshes hold their geometry by shared_ptr and let go of it when they change
+// or are finalized; the registry only keeps weak references, so a geometry
+// goes away with the last mesh using it. Meshes asking for geometry that has
+// been refined get the refined one.
+class MeshGeometryRegistry final {
+    public:
+        // The geometry of points and indices, shared with every other mesh
+        // that has the same ones. Otherwise a new geometry is made, refitting
+        // refitSource's BVH if given, see MeshGeometry. Safe to call from
+        // concurrent Syncs.
+        //
+        // Points are quantized if HDTEMPLATE_QUANTIZE_POINTS is set, and
+        // meshes are told apart by their quantized points, so meshes that
+        // only differ by less than a quantization step share a geometry.
+        std::shared_ptr<MeshGeometry> Acquire(const VtVec3fArray &points,
+                                              const VtVec3iArray &indices,
+                                              std::shared_ptr<const MeshGeometry> refitSource);
+
+        // Forget the geometries no mesh holds anymore.
+        void GarbageCollect();
+
+        // Number of geometries still held by some mesh.
+        size_t GetGeometryCount() const;
+
+    private:
+        friend class MeshGeometry;
+
+        // File geometry under key.
+        void _Insert(uint64_t key, const std::shared_ptr<MeshGeometry> &geometry);
+
+        mutable std::mutex _mutex;
+        // Keyed by CompactMesh::ComputeHash. The meshes are compared as
+        // well, so a collision only costs the sharing.
+        std::unordered_multimap<uint64_t, std::weak_ptr<MeshGeometry>> _geometries;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/base/gf/ray.h"
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Primary rays are traced in packets covering a square block of pixels.
+static constexpr int RayPacketBlockSize = 4;
+static constexpr int RayPacketSize = RayPacketBlockSize * RayPacketBlockSize;
+
+// Once fewer rays than this are still active below a node, the rest of its
+// subtree is traversed one ray at a time.
+static constexpr int RayPacketMinActive = RayPacketSize / 4;
+
+static_assert(RayPacketSize <= 32, "Packet lanes must fit in a 32 bit mask");
+static_assert(RayPacketSize % 4 == 0, "Packets are tested four lanes at a time");
+
+// Rays traced together, stored as structure of arrays so one box can be
+// tested against many rays at once. Lanes are addressed by bit masks.
+struct alignas(64) BVHRayPacket {
+    float origin[3][RayPacketSize];
+    float direction[3][RayPacketSize];
+    float invDirection[3][RayPacketSize];
+    float tMin[RayPacketSize];
+    float tMax[RayPacketSize];
+
+    void Set(int lane, const GfRay &ray, float rayTMin, float rayTMax) {
+        const BVHRay bvhRay(ray, rayTMin, rayTMax);
+        for (int a = 0; a < 3; ++a) {
+            origin[a][lane] = bvhRay.origin[a];
+            direction[a][lane] = bvhRay.direction[a];
+            invDirection[a][lane] = bvhRay.invDirection[a];
+        }
+        tMin[lane] = rayTMin;
+        tMax[lane] = rayTMax;
+    }
+
+    void Set(int lane, const BVHRay &ray) {
+        for (int a = 0; a < 3; ++a) {
+            origin[a][lane] = ray.origin[a];
+            direction[a][lane] = ray.direction[a];
+            invDirection[a][lane] = ray.invDirection[a];
+        }
+        tMin[lane] = ray.tMin;
+        tMax[lane] = ray.tMax;
+    }
+
+    BVHRay GetRay(int lane) const {
+        return BVHRay(GfVec3f(origin[0][lane], origin[1][lane], origin[2][lane]),
+                      GfVec3f(direction[0][lane], direction[1][lane], direction[2][lane]),
+                      GfVec3f(invDirection[0][lane], invDirection[1][lane], invDirection[2][lane]),
+                      tMin[lane], tMax[lane]);
+    }
+
+    // Which of the eight direction octants a lane's ray points into.
+    int GetOctant(int lane) const {
+        return (invDirection[0][lane] < 0.0f ? 1 : 0) |
+               (invDirection[1][lane] < 0.0f ? 2 : 0) |
+               (invDirection[2][lane] < 0.0f ? 4 : 0);
+    }
+};
+
+// Slab test of one box, given as min x, y, z and max x, y, z, against the
+// lanes in activeMask. The lanes must share one octant, described by the
+// near and far rows of nearRow/farRow. Returns the lanes that hit and writes
+// the nearest entry distance among them.
+inline uint32_t IntersectBVHRayPacket(const BVHRayPacket &packet, uint32_t activeMask,
+                                      const int nearRow[3], const int farRow[3],
+                                      const float bounds[6], float *tEnterMin)
+{
+    uint32_t mask = 0;
+    float tEnter = std::numeric_limits<float>::infinity();
+
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 widen = _mm_set1_ps(1.00000024f);
+    __m128 tEnter4 = _mm_set1_ps(std::numeric_limits<float>::infinity());
+
+    for (int k = 0; k < RayPacketSize; k += 4) {
+        if (((activeMask >> k) & 0xfu) == 0)
+            continue;
+
+        __m128 tNear = _mm_load_ps(packet.tMin + k);
+        __m128 tFar = _mm_load_ps(packet.tMax + k);
+        for (int a = 0; a < 3; ++a) {
+            const __m128 origin = _mm_load_ps(packet.origin[a] + k);
+            const __m128 invDirection = _mm_load_ps(packet.invDirection[a] + k);
+            const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds[nearRow[a]]), origin), invDirection);
+            const __m128 t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds[farRow[a]]), origin), invDirection), widen);
+            // Running values second, so NaN slabs are ignored as in the
+            // scalar loop below.
+            tNear = _mm_max_ps(t0, tNear);
+            tFar = _mm_min_ps(t1, tFar);
+        }
+
+        const __m128 hit = _mm_cmple_ps(tNear, tFar);
+        const uint32_t hitMask = static_cast<uint32_t>(_mm_movemask_ps(hit)) & ((activeMask >> k) & 0xfu);
+        if (hitMask == 0)
+            continue;
+
+        // Only lanes that are active and hit may lower the entry distance.
+        const __m128i laneBits = _mm_set_epi32(8, 4, 2, 1);
+        const __m128 counted = _mm_castsi128_ps(_mm_cmpeq_epi32(
+            _mm_and_si128(_mm_set1_epi32(static_cast<int>(hitMask)), laneBits), laneBits));
+        tEnter4 = _mm_min_ps(tEnter4, _mm_or_ps(_mm_and_ps(counted, tNear),
+                                                _mm_andnot_ps(counted, _mm_set1_ps(std::numeric_limits<float>::infinity()))));
+        mask |= hitMask << k;
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, tEnter4);
+    tEnter = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+#else
+    for (int k = 0; k < RayPacketSize; ++k) {
+        if (!(activeMask & (1u << k)))
+            continue;
+
+        float tNear = packet.tMin[k];
+        float tFar = packet.tMax[k];
+        for (int a = 0; a < 3; ++a) {
+            tNear = std::max(tNear, (bounds[nearRow[a]] - packet.origin[a][k]) * packet.invDirection[a][k]);
+            tFar = std::min(tFar, (bounds[farRow[a]] - packet.origin[a][k]) * packet.invDirection[a][k] * 1.00000024f);
+        }
+
+        if (tNear <= tFar) {
+            mask |= 1u << k;
+            tEnter = std::min(tEnter, tNear);
+        }
+    }
+#endif
+
+    *tEnterMin = tEnter;
+    return mask;
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -2,6 +2,7 @@
 #include "pxr/imaging/hd/extComputation.h"
 #include "pxr/imaging/hd/resourceRegistry.h"
 #include "pxr/imaging/hd/tokens.h"
+#include "pxr/base/vt/types.h"
 #include <pxr/pxr.h>
 #include <pxr/imaging/hd/rendererPlugin.h>
 #include <pxr/imaging/hd/renderThread.h>
@@ -12,7 +13,9 @@
 #include "pxr/imaging/hd/bprim.h"
 
 #include "renderBuffer.h"
+#include "resourceRegistry.h"
 
+#include "instancer.h"
 #include "mesh.h"
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -57,8 +60,22 @@ HdTemplateRenderDelegate::HdTemplateRenderDelegate(const HdRenderSettingsMap &se
 
 void HdTemplateRenderDelegate::_Initialize()
 {
+    MeshGeometryRegistry *meshGeometryRegistry = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
+
+        if (_counterResourceRegistry.fetch_add(1) == 0) {
+            _resourceRegistry = std::make_shared<HdTemplateResourceRegistry>();
+        }
+
+        // The registry lives as long as any delegate does, so the pointer
+        // stays valid for this one's meshes.
+        meshGeometryRegistry = &std::static_pointer_cast<HdTemplateResourceRegistry>(
+            _resourceRegistry)->GetMeshGeometryRegistry();
+    }
+
     _renderParam = std::make_shared<HdTemplateRenderParam>(
-        &_renderThread, nullptr, &_sceneVersion
+        &_renderThread, nullptr, &_sceneVersion, meshGeometryRegistry
     );
 
     _renderer = new HdTemplateRenderer();
@@ -67,12 +84,6 @@ void HdTemplateRenderDelegate::_Initialize()
     _renderThread.SetRenderCallback(
         std::bind(_RenderCallback, _renderer, &_renderThread));
     _renderThread.StartThread();
-
-    std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
-
-    if (_counterResourceRegistry.fetch_add(1) == 0) {
-        _resourceRegistry = std::make_shared<HdResourceRegistry>();
-    }
 }
 
 // Destructor
@@ -100,6 +111,9 @@ HdRenderParam* HdTemplateRenderDelegate::GetRenderParam()  const
 
 void HdTemplateRenderDelegate::CommitResources(HdChangeTracker* tracker) 
 {
+    // Meshes synced or finalized since the last commit may have left
+    // geometry nobody uses, in this delegate or any other.
+    _resourceRegistry->GarbageCollect();
 }
 
 TfTokenVector const&
@@ -148,10 +162,40 @@ HdTemplateRenderDelegate::GetDefaultAovDescriptor(TfToken const& name) const
     return HdAovDescriptor();
 }
 
+static VtInt64Array _ToArray(const std::vector<size_t> &values)
+{
+    return VtInt64Array(values.begin(), values.end());
+}
+
+static VtDictionary _ToDictionary(const BVHStats &stats)
+{
+    VtDictionary dict;
+    dict["nodeCount"] = VtValue(static_cast<int64_t>(stats.numNodes));
+    dict["leafCount"] = VtValue(static_cast<int64_t>(stats.numLeaves));
+    dict["primitiveCount"] = VtValue(static_cast<int64_t>(stats.numPrims));
+    dict["leafDepthHistogram"] = VtValue(_ToArray(stats.leafDepths));
+    dict["leafSizeHistogram"] = VtValue(_ToArray(stats.leafSizes));
+    dict["sahCost"] = VtValue(static_cast<double>(stats.sahCost));
+    dict["siblingOverlap"] = VtValue(static_cast<double>(stats.siblingOverlap));
+    dict["memoryBytes"] = VtValue(static_cast<int64_t>(stats.memorySize));
+    dict["buildTimeSeconds"] = VtValue(stats.buildTime);
+    return dict;
+}
+
 VtDictionary 
 HdTemplateRenderDelegate::GetRenderStats() const
 {
+    const SceneBVHStats bvhStats = _renderer->GetBVHStats();
+
     VtDictionary stats;
+    stats["meshCount"] = VtValue(static_cast<int64_t>(bvhStats.numMeshes));
+    stats["meshGeometryCount"] = VtValue(static_cast<int64_t>(bvhStats.numGeometries));
+    stats["topLevelBVH"] = VtValue(_ToDictionary(bvhStats.topLevel));
+    stats["meshBVHs"] = VtValue(_ToDictionary(bvhStats.meshes));
+    if (bvhStats.meshes.numPrims > 0) {
+        stats["meshBytesPerMillionTriangles"] = VtValue(static_cast<int64_t>(
+            bvhStats.meshes.memorySize * 1000000 / bvhStats.meshes.numPrims));
+    }
     return stats;
 }
 
@@ -179,15 +223,14 @@ HdRenderPassSharedPtr HdTemplateRenderDelegate::CreateRenderPass(HdRenderIndex *
                 HdRprimCollection const& collection)
 {
     // Implement the required functionality
-    return HdRenderPassSharedPtr(new HdTemplateRenderPass(index, collection, &_renderThread, _renderer, &_sceneVersion)); // Example, create and return a render pass
+    return HdRenderPassSharedPtr(new HdTemplateRenderPass(index, collection, &_renderThread, _renderer, &_sceneVersion, &_meshSetVersion)); // Example, create and return a render pass
 }
 
 HdInstancer *
 HdTemplateRenderDelegate::CreateInstancer(HdSceneDelegate *delegate,
                                         SdfPath const& id)
 {
-    //return new HdTemplateInstancer(delegate, id);
-    return nullptr;
+    return new HdTemplateInstancer(delegate, id);
 }
 
 void
@@ -201,6 +244,7 @@ HdTemplateRenderDelegate::CreateRprim(TfToken const& typeId,
                                     SdfPath const& rprimId)
 {
     if (typeId == HdPrimTypeTokens->mesh) {
+        _meshSetVersion++;
         return new HdTemplateMesh(rprimId);
     } else {
         TF_CODING_ERROR("Unknown Rprim Type %s", typeId.GetText());
@@ -212,6 +256,8 @@ HdTemplateRenderDelegate::CreateRprim(TfToken const& typeId,
 void
 HdTemplateRenderDelegate::DestroyRprim(HdRprim *rPrim)
 {
+    // Finalize has stopped the render thread already.
+    _meshSetVersion++;
     delete rPrim;
 }
 
@@ -95,6 +95,8 @@ private:
 
     static std::mutex _mutexResourceRegistry;
     static std::atomic_int _counterResourceRegistry;
+    // An HdTemplateResourceRegistry, shared by every delegate in the
+    // process and released with the last of them.
     static HdResourceRegistrySharedPtr _resourceRegistry;
 
     HdRenderSettingDescriptorList _settingDescriptors;
@@ -108,6 +110,10 @@ private:
 
     std::atomic<int> _sceneVersion;
 
+    // Bumped whenever a mesh is created or destroyed, so render passes know
+    // to gather their meshes again. Other edits only bump _sceneVersion.
+    std::atomic<int> _meshSetVersion{0};
+
 
     // This class does not support copying.
     HdTemplateRenderDelegate(const HdTemplateRenderDelegate &) = delete;
@@ -24,8 +24,10 @@ PXR_NAMESPACE_OPEN_SCOPE
 /// 
 class HdTemplateRenderParam : public HdRenderParam {
   public:
-    HdTemplateRenderParam(HdRenderThread* renderThread, SceneData *scene, std::atomic<int> *sceneVersion) 
-    : _scene(scene), _renderThread(renderThread), _sceneVersion(sceneVersion)
+    HdTemplateRenderParam(HdRenderThread* renderThread, SceneData *scene, std::atomic<int> *sceneVersion,
+                          MeshGeometryRegistry *meshGeometryRegistry)
+    : _scene(scene), _renderThread(renderThread), _sceneVersion(sceneVersion),
+      _meshGeometryRegistry(meshGeometryRegistry)
     {
 
     }
@@ -40,11 +42,19 @@ class HdTemplateRenderParam : public HdRenderParam {
       return _scene;
     }
 
+    // Where meshes get their geometry, so that identical ones share it,
+    // across all render delegates in the process.
+    MeshGeometryRegistry& GetMeshGeometryRegistry() const {
+      return *_meshGeometryRegistry;
+    }
+
 private:
     HdRenderThread* _renderThread;
     SceneData* _scene;
 
     std::atomic<int>* _sceneVersion;
+
+    MeshGeometryRegistry* _meshGeometryRegistry;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -6,17 +6,21 @@
 #include "pxr/imaging/hd/renderPassState.h"
 #include "renderDelegate.h"
 
+#include <algorithm>
 #include <atomic>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
-HdTemplateRenderPass::HdTemplateRenderPass(HdRenderIndex *index, HdRprimCollection const& collection, HdRenderThread *renderThread, HdTemplateRenderer *renderer, std::atomic<int> *sceneVersion)
+HdTemplateRenderPass::HdTemplateRenderPass(HdRenderIndex *index, HdRprimCollection const& collection, HdRenderThread *renderThread, HdTemplateRenderer *renderer, std::atomic<int> *sceneVersion, std::atomic<int> *meshSetVersion)
     : HdRenderPass(index, collection)
     , _renderThread(renderThread)
     , _renderer(renderer)
     , _sceneVersion(sceneVersion)
     , _lastSceneVersion(0)
+    , _meshSetVersion(meshSetVersion)
+    , _lastMeshSetVersion(meshSetVersion->load())
     , _lastSettingsVersion(0)
+    , _filterDirty(true)
     , _colorBuffer(SdfPath::EmptyPath())
     , _depthBuffer(SdfPath::EmptyPath())
     , _converged(false)
@@ -59,9 +63,37 @@ void HdTemplateRenderPass::_Execute(HdRenderPassStateSharedPtr const &renderPass
                                     TfTokenVector const &renderTags)
 {
     bool needStartRender = false;
+    bool filterChanged = false;
+
+    // Meshes join or leave the top level when the render tags or the
+    // collection change, as well as when the scene itself does.
+    TfTokenVector sortedRenderTags = renderTags;
+    std::sort(sortedRenderTags.begin(), sortedRenderTags.end());
+    if (_filterDirty || _renderTags != sortedRenderTags) {
+        _renderTags.swap(sortedRenderTags);
+        _filterDirty = false;
+
+        _renderThread->StopRender();
+        _renderer->SetSceneFilter(GetRprimCollection(), _renderTags);
+        filterChanged = true;
+    }
+
+    // Meshes have been created or destroyed since the scene last gathered
+    // them, so gather them again rather than trace ones that are gone. That
+    // starts the top level over, so other edits keep the scene and let
+    // BuildBVH refit or reuse what it can.
+    int currentMeshSetVersion = _meshSetVersion->load();
+    bool meshesChanged = false;
+    if (_lastMeshSetVersion != currentMeshSetVersion) {
+        _renderThread->StopRender();
+        _renderer->SetScene(SceneData(GetRenderIndex()));
+        _renderer->SetSceneFilter(GetRprimCollection(), _renderTags);
+        _lastMeshSetVersion = currentMeshSetVersion;
+        meshesChanged = true;
+    }
 
     int currentSceneVersion = _sceneVersion->load();
-    if (_lastSceneVersion != currentSceneVersion) {
+    if (_lastSceneVersion != currentSceneVersion || filterChanged || meshesChanged) {
         needStartRender = true;
         _renderer->BuildBVH();
         _lastSceneVersion = currentSceneVersion;
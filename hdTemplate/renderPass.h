@@ -32,7 +32,7 @@ PXR_NAMESPACE_OPEN_SCOPE
 class HdTemplateRenderPass final : public HdRenderPass
 {
 public:
-    HdTemplateRenderPass(HdRenderIndex* index, HdRprimCollection const& collection, HdRenderThread* renderThread, HdTemplateRenderer *renderer, std::atomic<int> *sceneVersion);
+    HdTemplateRenderPass(HdRenderIndex* index, HdRprimCollection const& collection, HdRenderThread* renderThread, HdTemplateRenderer *renderer, std::atomic<int> *sceneVersion, std::atomic<int> *meshSetVersion);
 
     ~HdTemplateRenderPass() override;
 
@@ -42,7 +42,9 @@ protected:
     void _Execute(HdRenderPassStateSharedPtr const &renderPassState,
                   TfTokenVector const &renderTags) override;
     
-    void _MarkCollectionDirty() override {}
+    void _MarkCollectionDirty() override {
+        _filterDirty = true;
+    }
 
 private:
     HdRenderThread* _renderThread;
@@ -55,9 +57,19 @@ private:
     // The last scene version we rendered with.
     int _lastSceneVersion;
 
+    // The render delegate's count of meshes created and destroyed, and its
+    // value when the scene last gathered its meshes.
+    std::atomic<int> *_meshSetVersion;
+    int _lastMeshSetVersion;
+
     // The last settings version we rendered with.
     int _lastSettingsVersion;
 
+    // The render tags of the last execute, sorted, and whether they or the
+    // collection changed since the scene filter was last set.
+    TfTokenVector _renderTags;
+    bool _filterDirty;
+
     GfRect2i _dataWindow;
 
     GfMatrix4d _viewMatrix;
@@ -2,11 +2,14 @@
 #include "sceneData.h"
 #include "renderBuffer.h"
 #include "renderDelegate.h"
+#include "integrator.h"
+#include "mappedStorage.h"
 
 #include "pxr/imaging/hd/perfLog.h"
 
 #include "pxr/base/gf/matrix3f.h"
 #include "pxr/base/gf/vec2f.h"
+#include "pxr/base/gf/vec2i.h"
 #include "pxr/base/work/loops.h"
 #include "pxr/base/tf/hash.h"
 #include "pxr/base/tf/staticTokens.h"
@@ -42,6 +45,26 @@ void HdTemplateRenderer::SetScene(SceneData scene)
     _scene = scene;
 }
 
+void HdTemplateRenderer::BuildBVH()
+{
+    _scene.BuildBVH();
+    _UpdateBVHStats();
+}
+
+SceneBVHStats HdTemplateRenderer::GetBVHStats() const
+{
+    std::lock_guard<std::mutex> lock(_bvhStatsMutex);
+    return _bvhStats;
+}
+
+void HdTemplateRenderer::_UpdateBVHStats()
+{
+    SceneBVHStats stats = _scene.GetBVHStats();
+
+    std::lock_guard<std::mutex> lock(_bvhStatsMutex);
+    _bvhStats = std::move(stats);
+}
+
 void HdTemplateRenderer::SetDataWindow(const GfRect2i &dataWindow)
 {
     _dataWindow = dataWindow;
@@ -326,6 +349,19 @@ void HdTemplateRenderer::Render(HdRenderThread *renderThread)
             break;
         }
 
+        // No tiles are in flight, so this is where BVHs built in the
+        // background can take over from the ones traced so far.
+        _scene.ApplyRefinedBVHs();
+
+        // Stats are read from other threads, so they're taken here, with the
+        // refined BVHs and any built lazily by the last sample. Each geometry
+        // keeps its own, so this only walks the meshes.
+        _UpdateBVHStats();
+
+        // Tracing is also done for now, so this is where mapped geometry
+        // past the resident budget is paged out.
+        MappedStorage::GetInstance().Trim();
+
         const unsigned int numTilesX = (_dataWindow.GetWidth() + _tileSize - 1) / _tileSize;
         const unsigned int numTilesY = (_dataWindow.GetHeight() + _tileSize - 1) / _tileSize;
 
@@ -389,6 +425,12 @@ void HdTemplateRenderer::_RenderTiles(HdRenderThread *renderThread, int sampleNu
     auto uniform_float = [&random, &uniform_dist]()
     { return uniform_dist(random); };
 
+    // Reused by every tile in the range.
+    WavefrontIntegrator integrator;
+    std::vector<GfRay> rays;
+    std::vector<GfVec2i> pixels;
+    std::vector<HitData> hits;
+
     for (unsigned int tile = tileStart; tile < tileEnd; ++tile)
     {
         if (renderThread && renderThread->IsStopRequested())
@@ -408,75 +450,108 @@ void HdTemplateRenderer::_RenderTiles(HdRenderThread *renderThread, int sampleNu
         const float w(_dataWindow.GetWidth());
         const float h(_dataWindow.GetHeight());
 
-        for (unsigned int y = y0; y < y1; ++y)
+        // One camera ray through a jittered position inside the pixel.
+        auto makeRay = [&](unsigned int x, unsigned int y)
         {
-            for (unsigned int x = x0; x < x1; ++x)
-            {
-                if (renderThread && renderThread->IsStopRequested()) {
-                    return; // Exit the function early if the render thread is stopped
-                }
-
-                GfVec4f Cd(0.0f, 0.0f, 0.0f, 1.0f);
-                GfVec3f N(0.0f);
-                GfVec3f P(0.0f);
-                float z = 0;
+            GfVec2f jitter(uniform_float(), uniform_float());
+            // GfVec2f jitter(0.0f);
 
-                GfVec2f jitter(uniform_float(), uniform_float());
-                // GfVec2f jitter(0.0f);
+            const GfVec3f ndc(
+                2 * ((x + jitter[0] - _dataWindow.GetMinX()) / w) - 1,
+                2 * ((y + jitter[1] - _dataWindow.GetMinY()) / h) - 1,
+                -1);
 
-                const GfVec3f ndc(
-                    2 * ((x + jitter[0] - _dataWindow.GetMinX()) / w) - 1,
-                    2 * ((y + jitter[1] - _dataWindow.GetMinY()) / h) - 1,
-                    -1);
+            const GfVec3f nearPlaneTrace(_inverseProjMatrix.Transform(ndc));
 
-                const GfVec3f nearPlaneTrace(_inverseProjMatrix.Transform(ndc));
+            GfVec3f dir = GfVec3f(_inverseViewMatrix.TransformDir(nearPlaneTrace)).GetNormalized();
 
-                GfVec3f dir = GfVec3f(_inverseViewMatrix.TransformDir(nearPlaneTrace)).GetNormalized();
+            return GfRay(GfVec3d(origin), GfVec3d(dir));
+        };
 
-                GfRay ray = GfRay(GfVec3d(origin), GfVec3d(dir));
+        // Neighbouring camera rays take nearly the same path through the
+        // BVHs, so the rays are laid out block by block for the integrator
+        // to trace each block as one packet.
+        const unsigned int blockSize = _tracePackets ? RayPacketBlockSize : 1;
 
-                HitData hit = _scene.Intersect(ray, _numBounces);
-
-                Cd += hit.Cd;
-                N += hit.N;
-                P += hit.P;
-                z += hit.t;
+        rays.clear();
+        pixels.clear();
+        for (unsigned int by = y0; by < y1; by += blockSize)
+        {
+            for (unsigned int bx = x0; bx < x1; bx += blockSize)
+            {
+                const unsigned int bx1 = std::min(bx + blockSize, x1);
+                const unsigned int by1 = std::min(by + blockSize, y1);
 
-                for (size_t i = 0; i < _aovBindings.size(); ++i)
+                for (unsigned int y = by; y < by1; ++y)
                 {
-                    HdTemplateRenderBuffer *renderBuffer = static_cast<HdTemplateRenderBuffer *>(_aovBindings[i].renderBuffer);
-
-                    if (renderBuffer->IsConverged())
-                    {
-                        continue;
-                    }
-                    if (_aovNames[i].name == HdAovTokens->color)
-                    {
-                        renderBuffer->Write(GfVec3i(x, y, 1), 4, Cd.data());
-                    }
-                    else if ((_aovNames[i].name == HdAovTokens->cameraDepth || _aovNames[i].name == HdAovTokens->depth) && renderBuffer->GetFormat() == HdFormatFloat32)
-                    {
-                        renderBuffer->Write(GfVec3i(x, y, 1), 1, &z);
-                    }
-                    else if (_aovNames[i].name == HdAovTokens->Peye && renderBuffer->GetFormat() == HdFormatFloat32Vec3)
-                    {
-                        renderBuffer->Write(GfVec3i(x, y, 1), 3, P.data());
-                    }
-                    else if ((_aovNames[i].name == HdAovTokens->Neye ||
-                              _aovNames[i].name == HdAovTokens->normal) &&
-                             renderBuffer->GetFormat() == HdFormatFloat32Vec3)
-                    {
-                        renderBuffer->Write(GfVec3i(x, y, 1), 3, N.data());
-                    }
-                    else if (_aovNames[i].isPrimvar &&
-                             renderBuffer->GetFormat() == HdFormatFloat32Vec3)
+                    for (unsigned int x = bx; x < bx1; ++x)
                     {
-                        GfVec3f value;
-                        renderBuffer->Write(GfVec3i(x, y, 1), 3, value.data());
+                        rays.push_back(makeRay(x, y));
+                        pixels.push_back(GfVec2i(x, y));
                     }
                 }
             }
         }
+
+        // Every path in the tile advances one bounce at a time.
+        hits.resize(rays.size());
+        integrator.Render(_scene, rays.data(), rays.size(), _numBounces, _tracePackets, hits.data());
+
+        if (renderThread && renderThread->IsStopRequested()) {
+            return; // Exit the function early if the render thread is stopped
+        }
+
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            _WriteAovs(pixels[i][0], pixels[i][1], hits[i]);
+        }
+    }
+}
+
+void HdTemplateRenderer::_WriteAovs(unsigned int x, unsigned int y, const HitData &hit)
+{
+    GfVec4f Cd(0.0f, 0.0f, 0.0f, 1.0f);
+    GfVec3f N(0.0f);
+    GfVec3f P(0.0f);
+    float z = 0;
+
+    Cd += hit.Cd;
+    N += hit.N;
+    P += hit.P;
+    z += hit.t;
+
+    for (size_t i = 0; i < _aovBindings.size(); ++i)
+    {
+        HdTemplateRenderBuffer *renderBuffer = static_cast<HdTemplateRenderBuffer *>(_aovBindings[i].renderBuffer);
+
+        if (renderBuffer->IsConverged())
+        {
+            continue;
+        }
+        if (_aovNames[i].name == HdAovTokens->color)
+        {
+            renderBuffer->Write(GfVec3i(x, y, 1), 4, Cd.data());
+        }
+        else if ((_aovNames[i].name == HdAovTokens->cameraDepth || _aovNames[i].name == HdAovTokens->depth) && renderBuffer->GetFormat() == HdFormatFloat32)
+        {
+            renderBuffer->Write(GfVec3i(x, y, 1), 1, &z);
+        }
+        else if (_aovNames[i].name == HdAovTokens->Peye && renderBuffer->GetFormat() == HdFormatFloat32Vec3)
+        {
+            renderBuffer->Write(GfVec3i(x, y, 1), 3, P.data());
+        }
+        else if ((_aovNames[i].name == HdAovTokens->Neye ||
+                  _aovNames[i].name == HdAovTokens->normal) &&
+                 renderBuffer->GetFormat() == HdFormatFloat32Vec3)
+        {
+            renderBuffer->Write(GfVec3i(x, y, 1), 3, N.data());
+        }
+        else if (_aovNames[i].isPrimvar &&
+                 renderBuffer->GetFormat() == HdFormatFloat32Vec3)
+        {
+            GfVec3f value;
+            renderBuffer->Write(GfVec3i(x, y, 1), 3, value.data());
+        }
     }
 }
 
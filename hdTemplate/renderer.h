@@ -12,6 +12,8 @@
 
 #include <random>
 #include <atomic>
+#include <iosfwd>
+#include <mutex>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -23,6 +25,12 @@ public:
 
     void SetScene(SceneData scene);
 
+    // See SceneData::SetFilter.
+    void SetSceneFilter(const HdRprimCollection &collection,
+                        const TfTokenVector &renderTags) {
+        _scene.SetFilter(collection, renderTags);
+    }
+
     void SetDataWindow(const GfRect2i &dataWindow);
 
     void SetCamera(const GfMatrix4d& viewMatrix, const GfMatrix4d& projMatrix);
@@ -37,8 +45,18 @@ public:
 
     void Clear();
 
-    void BuildBVH() {
-        _scene.BuildBVH();
+    void BuildBVH();
+
+    // See SceneData::GetBVHStats. Taken when the scene is built and again
+    // between samples, so unlike the scene itself this may be read while
+    // rendering, and even between a mesh being finalized and the scene
+    // being gathered again.
+    SceneBVHStats GetBVHStats() const;
+
+    // See SceneData::DumpBVHStats. This reads the meshes themselves, so the
+    // render thread must be stopped and the scene built since the last Sync.
+    void DumpBVHStats(std::ostream &out) const {
+        _scene.DumpBVHStats(out);
     }
 
     void MarkAovBuffersUnconverged();
@@ -51,6 +69,8 @@ private:
 
     void _RenderTiles(HdRenderThread *renderThread, int sampleNum, size_t tileStart, size_t tileEnd);
 
+    void _WriteAovs(unsigned int x, unsigned int y, const HitData &hit);
+
     static GfVec4f _GetClearColor(VtValue const& clearValue);
 
     // Data window - as in CameraUtilFraming.
@@ -84,10 +104,19 @@ private:
     int _numSamples = 64;
     int _tileSize = 32;
 
+    // Trace camera rays in packets of RayPacketBlockSize squared pixels
+    // rather than one at a time. Bounces are always traced one at a time.
+    bool _tracePackets = true;
+
     std::atomic<int> _completedSamples;
 
     SceneData _scene;
 
+    // Snapshot of _scene.GetBVHStats() handed out by GetBVHStats.
+    void _UpdateBVHStats();
+    SceneBVHStats _bvhStats;
+    mutable std::mutex _bvhStatsMutex;
+
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
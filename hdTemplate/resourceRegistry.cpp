@@ -0,0 +1,21 @@
+#include "resourceRegistry.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+HdTemplateResourceRegistry::HdTemplateResourceRegistry() = default;
+
+HdTemplateResourceRegistry::~HdTemplateResourceRegistry() = default;
+
+VtDictionary HdTemplateResourceRegistry::GetResourceAllocation() const
+{
+    VtDictionary result = HdResourceRegistry::GetResourceAllocation();
+    result["meshGeometryCount"] = VtValue(static_cast<int64_t>(_meshGeometryRegistry.GetGeometryCount()));
+    return result;
+}
+
+void HdTemplateResourceRegistry::_GarbageCollect()
+{
+    _meshGeometryRegistry.GarbageCollect();
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/imaging/hd/resourceRegistry.h"
+#include "pxr/base/vt/dictionary.h"
+
+#include "meshGeometry.h"
+
+#include <memory>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Resources shared by every HdTemplateRenderDelegate in the process. Viewers
+// of the same stage sync meshes with the same points and topology, which get
+// the same triangles and BVH from here, so only the first of them builds
+// anything.
+class HdTemplateResourceRegistry final : public HdResourceRegistry {
+    public:
+        HdTemplateResourceRegistry();
+
+        ~HdTemplateResourceRegistry() override;
+
+        MeshGeometryRegistry &GetMeshGeometryRegistry() {
+            return _meshGeometryRegistry;
+        }
+
+        VtDictionary GetResourceAllocation() const override;
+
+    protected:
+        void _GarbageCollect() override;
+
+    private:
+        MeshGeometryRegistry _meshGeometryRegistry;
+};
+
+using HdTemplateResourceRegistrySharedPtr = std::shared_ptr<HdTemplateResourceRegistry>;
+
+PXR_NAMESPACE_CLOSE_SCOPE
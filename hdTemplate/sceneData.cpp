@@ -1,40 +1,13 @@
 #include "sceneData.h"
-#include <bits/stdc++.h>
+#include "pxr/imaging/hd/perfLog.h"
+#include <algorithm>
+#include <ostream>
 #include <random>
+#include <unordered_set>
+#include <utility>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
-static float randomFloat()
-{
-    return ((float)(rand()) / (float)(RAND_MAX)-0.5f) * 2.0f;
-}
-
-// Helper function to generate a random vector within a hemisphere
-static GfVec3f RandomHemisphereDirection(const GfVec3f &normal)
-{
-    // Create a random vector in the tangent plane
-    GfVec3f randomDirection;
-
-    while (true)
-    {
-        randomDirection = GfVec3f(randomFloat(), randomFloat(), randomFloat());
-
-        if (randomDirection.GetLength() < 1.0f)
-        {
-            randomDirection = randomDirection.GetNormalized();
-            break;
-        }
-    }
-
-    // If the normal is pointing upwards (or along a specific axis), make sure the random vector is in the hemisphere
-    if (randomDirection * normal < 0.0f)
-    {
-        randomDirection = -randomDirection; // Reflect the vector to ensure it's in the correct hemisphere
-    }
-
-    return randomDirection;
-};
-
 SceneData::SceneData(HdRenderIndex *index)
 {
     const SdfPathVector rprimIds = index->GetRprimIds();
@@ -44,174 +17,254 @@ SceneData::SceneData(HdRenderIndex *index)
         // Retrieve the Rprim object from the render index using the rprimId
         const HdRprim *rprim = index->GetRprim(rprimId);
 
-        // Try casting the Rprim to an HdTemplateMesh object
-        if (const HdTemplateMesh *mesh = dynamic_cast<const HdTemplateMesh *>(rprim))
+        // Try casting the Rprim to an HdTemplateMesh object. The render
+        // delegate created it, so it's fine to drop the const the index
+        // hands it out with; see ApplyRefinedBVHs.
+        if (HdTemplateMesh *mesh = dynamic_cast<HdTemplateMesh *>(const_cast<HdRprim *>(rprim)))
         {
             // If the cast is successful, add the mesh to the collection
             _meshes.push_back(mesh);
         }
     }
-}
-
-void SceneData::BuildBVH()
-{
-    if (_meshes.empty())
-        return;
 
-    std::vector<const HdTemplateMesh *> meshes = _meshes;
-    _bvhRoot = BuildBVHRecursive(meshes);
+    _inCollection.assign(_meshes.size(), true);
 }
 
-BVHNode *SceneData::BuildBVHRecursive(std::vector<const HdTemplateMesh *> &meshes)
+void SceneData::SetFilter(const HdRprimCollection &collection,
+                          const TfTokenVector &renderTags)
 {
-    if (meshes.size() == 1)
+    const SdfPathVector &rootPaths = collection.GetRootPaths();
+    const SdfPathVector &excludePaths = collection.GetExcludePaths();
+
+    auto hasPrefix = [](const SdfPath &path, const SdfPathVector &prefixes)
     {
-        // Create a leaf node with the single mesh
-        BVHNode *node = new BVHNode();
-        node->bbox = meshes[0]->GetBBox();
-        node->mesh = meshes[0];
-        return node;
-    }
+        return std::any_of(prefixes.begin(), prefixes.end(),
+                           [&](const SdfPath &prefix) { return path.HasPrefix(prefix); });
+    };
 
-    // Calculate the bounding box of all meshes in this node
-    GfRange3d brange;
-    for (const HdTemplateMesh *mesh : meshes)
+    _inCollection.resize(_meshes.size());
+    for (size_t i = 0; i < _meshes.size(); ++i)
     {
-        brange.UnionWith(mesh->GetBBox().GetBox());
+        const SdfPath &id = _meshes[i]->GetId();
+        _inCollection[i] = hasPrefix(id, rootPaths) && !hasPrefix(id, excludePaths);
     }
 
-    GfBBox3d bbox(brange);
-
-    // Split the meshes along the middle of their bounding boxes
-    // For simplicity, let's split along the X-axis. You could split in other ways.
-    std::sort(meshes.begin(), meshes.end(), [&](const HdTemplateMesh *a, const HdTemplateMesh *b)
-              { return a->GetBBox().GetBox().GetMin()[0] < b->GetBBox().GetBox().GetMin()[0]; });
+    _renderTags = renderTags;
+}
 
-    size_t mid = meshes.size() / 2;
-    std::vector<const HdTemplateMesh *> leftMeshes(meshes.begin(), meshes.begin() + mid);
-    std::vector<const HdTemplateMesh *> rightMeshes(meshes.begin() + mid, meshes.end());
+bool SceneData::_IsTraced(size_t meshIndex) const
+{
+    const HdTemplateMesh *mesh = _meshes[meshIndex];
+    if (!_inCollection[meshIndex] || !mesh->IsVisible())
+        return false;
 
-    // Create internal nodes
-    BVHNode *node = new BVHNode();
-    node->bbox = bbox;
-    node->left = BuildBVHRecursive(leftMeshes);
-    node->right = BuildBVHRecursive(rightMeshes);
-    return node;
+    return _renderTags.empty() ||
+           std::find(_renderTags.begin(), _renderTags.end(), mesh->GetRenderTag()) != _renderTags.end();
 }
 
-HitData SceneData::Intersect(GfRay ray, int num_bounces)
+void SceneData::BuildBVH()
 {
-    IntersectData closestIT{
-        std::numeric_limits<double>::infinity(),
-        GfVec3f(0.0f)};
-
-    const HdTemplateMesh *closestMesh = nullptr;
+    HD_TRACE_FUNCTION();
 
-    // Start traversing the BVH
-    closestIT = IntersectBVH(ray, _bvhRoot, closestIT);
+    _bvhInstances.clear();
 
-    if (closestIT.t < std::numeric_limits<double>::infinity())
-    {
-        return HitData{
-            GetCd(closestIT, ray, num_bounces),
-            closestIT.N,
-            GfVec3f(ray.GetPoint(closestIT.t)),
-            closestIT.t};
-    }
-    else
+    // Gather the bounds of every mesh instance that has something to hit
+    std::vector<SceneInstance> instances;
+    std::vector<BVHBounds> instanceBounds;
+    for (size_t i = 0; i < _meshes.size(); ++i)
     {
-        return HitData{};
-    }
-}
+        if (!_IsTraced(i))
+            continue;
 
+        // Meshes start building their BVHs in Sync; the top level is only
+        // traced once they're done. Filtered out meshes may keep building.
+        HdTemplateMesh *mesh = _meshes[i];
+        mesh->WaitForBVH();
 
-static GfVec3f clamp(GfVec3f a, GfVec3f b) {
-    return GfVec3f(std::min(a[0], b[0]),std::min(a[1], b[1]),std::min(a[2], b[2]));
-}
+        for (size_t instance = 0; instance < mesh->GetInstanceCount(); ++instance)
+        {
+            const GfRange3d range = mesh->GetWorldBounds(instance);
+            if (range.IsEmpty())
+                continue;
 
+            BVHBounds bounds;
+            bounds.Grow(GfVec3f(range.GetMin()));
+            bounds.Grow(GfVec3f(range.GetMax()));
 
-GfVec4f SceneData::GetCd(IntersectData it, GfRay ray, int depth)
-{
-    if (depth == 0)
-    {
-        return GfVec4f(0.0f, 0.0f, 0.0f, 1.0f);
+            instances.push_back({mesh, static_cast<uint32_t>(instance)});
+            instanceBounds.push_back(bounds);
+        }
     }
 
-    GfVec3f light = GfVec3f(-12, -9, -8).GetNormalized();
-    float intensity = 2.0f;
-
-    float illum = std::max(it.N * -light, 0.0f) * intensity;
-
-    GfRay shadow_ray(ray.GetPoint(it.t), -light);
+    // When the same instances have only moved or deformed, the tree over
+    // them can be refit rather than built again.
+    if (instances != _bvhPrimInstances || !_bvh.Refit(instanceBounds))
+    {
+        _bvh.Build(instanceBounds, _buildOptions);
+    }
+    _wideBvh.Collapse(_bvh);
+    _bvhPrimInstances.swap(instances);
 
-    IntersectData shadowIT = IntersectBVH(shadow_ray, _bvhRoot, IntersectData{
-        std::numeric_limits<double>::infinity(),
-        GfVec3f(0.0f)}
-    );
+    _topLevelStats = _bvh.ComputeStats();
+    _topLevelStats.memorySize += _wideBvh.GetMemorySize();
 
-    if (shadowIT.t < std::numeric_limits<double>::infinity())
+    // Store the instances in leaf order so leaves index them directly
+    const std::vector<uint32_t> &primIndices = _bvh.GetPrimIndices();
+    _bvhInstances.resize(primIndices.size());
+    for (size_t i = 0; i < primIndices.size(); ++i)
     {
-        illum = 0.0f;
+        _bvhInstances[i] = _bvhPrimInstances[primIndices[i]];
     }
+}
 
+bool SceneData::ApplyRefinedBVHs()
+{
+    HD_TRACE_FUNCTION();
 
-    GfVec3f diffuse = clamp(it.Cd * illum, GfVec3f(1.0f));
-
-    GfVec3f randomDirection = RandomHemisphereDirection(it.N);
+    // Mesh bounds don't change, so the top level needs no update. Instances
+    // share the BVH of their mesh, so this covers them too.
+    bool changed = false;
+    for (HdTemplateMesh *mesh : _meshes)
+    {
+        changed |= mesh->ApplyRefinedBVH();
+    }
+    return changed;
+}
 
-    GfRay new_ray(ray.GetPoint(it.t), randomDirection);
+SceneBVHStats SceneData::GetBVHStats() const
+{
+    SceneBVHStats stats;
+    stats.topLevel = _topLevelStats;
+    stats.numMeshes = _meshes.size();
 
-    IntersectData closestIT{
-        std::numeric_limits<double>::infinity(),
-        GfVec3f(0.0f)};
+    std::unordered_set<const MeshGeometry *> geometries;
+    for (const HdTemplateMesh *mesh : _meshes)
+    {
+        const MeshGeometry *geometry = mesh->GetGeometry();
+        if (geometry && geometries.insert(geometry).second)
+        {
+            stats.meshes.Merge(mesh->GetBVHStats());
+        }
+    }
+    stats.numGeometries = geometries.size();
+    return stats;
+}
 
-    // Start traversing the BVH
-    closestIT = IntersectBVH(new_ray, _bvhRoot, closestIT);
+void SceneData::DumpBVHStats(std::ostream &out) const
+{
+    std::vector<std::pair<const HdTemplateMesh *, BVHStats>> meshStats;
+    meshStats.reserve(_meshes.size());
 
-    GfVec3f bounce = GfVec3f(0.0f);
+    SceneBVHStats stats;
+    stats.topLevel = _topLevelStats;
+    stats.numMeshes = _meshes.size();
 
-    if (closestIT.t < std::numeric_limits<double>::infinity())
+    std::unordered_set<const MeshGeometry *> geometries;
+    for (const HdTemplateMesh *mesh : _meshes)
     {
-        GfVec4f bounceCd = GetCd(closestIT, new_ray, depth - 1);
-
-        bounce = GfVec3f(bounceCd[0], bounceCd[1], bounceCd[2]);
+        meshStats.emplace_back(mesh, mesh->GetBVHStats());
+        const MeshGeometry *geometry = mesh->GetGeometry();
+        if (geometry && geometries.insert(geometry).second)
+        {
+            stats.meshes.Merge(meshStats.back().second);
+        }
+    }
+    stats.numGeometries = geometries.size();
+
+    out << "Top level BVH:\n";
+    stats.topLevel.Dump(out);
+    out << "BVHs of " << stats.numMeshes << " meshes, " << stats.numGeometries
+        << " distinct:\n";
+    stats.meshes.Dump(out);
+    if (stats.meshes.numPrims > 0)
+    {
+        out << "  memory per million triangles: "
+            << stats.meshes.memorySize * 1e6 / stats.meshes.numPrims / (1024 * 1024)
+            << " MB\n";
     }
 
+    std::sort(meshStats.begin(), meshStats.end(),
+              [](const auto &a, const auto &b)
+              {
+                  return a.second.sahCost > b.second.sahCost;
+              });
 
-    GfVec3f Cd = diffuse + it.Cd.GetLength() * bounce;
+    out << "Per mesh (triangles, nodes, max depth, SAH cost, overlap, KB, build ms):\n";
+    for (const auto &entry : meshStats)
+    {
+        const BVHStats &meshStat = entry.second;
+        out << "  " << entry.first->GetId().GetText()
+            << " " << meshStat.numPrims
+            << " " << meshStat.numNodes
+            << " " << (meshStat.leafDepths.empty() ? 0 : meshStat.leafDepths.size() - 1)
+            << " " << meshStat.sahCost
+            << " " << meshStat.siblingOverlap
+            << " " << meshStat.memorySize / 1024
+            << " " << meshStat.buildTime * 1000.0 << "\n";
+    }
+}
 
+void SceneData::IntersectPacket(const GfRay *rays, int numRays, IntersectData *closestIT) const
+{
+    BVHRayPacket packet;
+    for (int i = 0; i < numRays; ++i)
+    {
+        // Mesh hits closer than this are rejected anyway, so the top level
+        // can use the same bound.
+        packet.Set(i, rays[i], 0.0001f, static_cast<float>(closestIT[i].t));
+    }
 
+    const uint32_t activeMask = numRays == 32 ? ~0u : (1u << numRays) - 1u;
 
-    return GfVec4f(Cd[0], Cd[1], Cd[2], 1.0f);
+    // Each mesh shortens packet.tMax for the lanes it hits, which prunes the
+    // rest of the traversal of those lanes at both levels.
+    _wideBvh.TraversePacket(packet, activeMask, [&](uint32_t first, uint32_t count, uint32_t laneMask)
+    {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const SceneInstance &leaf = _bvhInstances[i];
+            leaf.mesh->IntersectPacket(packet, laneMask, closestIT, leaf.instance);
+        }
+    });
 }
 
-IntersectData SceneData::IntersectBVH(GfRay ray, BVHNode *node, IntersectData closestIT)
+void SceneData::Intersect(const GfRay &ray, IntersectData &closestIT) const
 {
-    if (!node)
-        return closestIT; // If node is null, return the closest intersection found so far
-
-    // Test if the ray intersects the bounding box of the current node
-    if (!ray.Intersect(node->bbox))
-        return closestIT; // If no intersection with the bounding box, skip this node
+    // Anything beyond the closest hit so far can't improve on it
+    BVHRay bvhRay(ray, 0.0f, static_cast<float>(closestIT.t));
 
-    // If it's a leaf node, check intersection with the mesh
-    if (node->IsLeaf())
+    _wideBvh.Traverse(bvhRay, [&](uint32_t first, uint32_t count)
     {
-        IntersectData it = node->mesh->Intersect(ray);
-
-        // If a valid intersection is found (t >= 0), and it's closer than the previous closest, update
-        if (it.t >= 0.0 && it.t < closestIT.t)
+        // Check intersection with every mesh instance in the leaf
+        for (uint32_t i = first; i < first + count; ++i)
         {
-            closestIT = it;
+            const SceneInstance &leaf = _bvhInstances[i];
+            IntersectData it = leaf.mesh->Intersect(ray, bvhRay.tMax, leaf.instance);
+
+            // If a valid intersection is found (t >= 0), and it's closer than the previous closest, update
+            if (it.t >= 0.0 && it.t < closestIT.t)
+            {
+                closestIT = it;
+                bvhRay.tMax = static_cast<float>(it.t);
+            }
         }
-        return closestIT; // Return the closest intersection found so far
-    }
+    });
+}
 
-    // Otherwise, recursively check left and right children
-    closestIT = IntersectBVH(ray, node->left, closestIT);
-    closestIT = IntersectBVH(ray, node->right, closestIT);
+bool SceneData::Occluded(const GfRay &ray, float tMin, float tMax) const
+{
+    const BVHRay bvhRay(ray, tMin, tMax);
 
-    return closestIT; // Return the closest intersection after checking both children
+    return _wideBvh.TraverseAny(bvhRay, [&](uint32_t first, uint32_t count)
+    {
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const SceneInstance &leaf = _bvhInstances[i];
+            if (leaf.mesh->Occluded(bvhRay, leaf.instance))
+                return true;
+        }
+        return false;
+    });
 }
 
 PXR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
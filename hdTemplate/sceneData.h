@@ -1,9 +1,14 @@
 #pragma once
 
 #include "mesh.h"
+#include "bvh.h"
+#include "rayPacket.h"
+#include "wideBVH.h"
+#include "pxr/imaging/hd/rprimCollection.h"
 #include "pxr/base/gf/matrix3f.h"
 #include "pxr/base/gf/vec2f.h"
 
+#include <iosfwd>
 #include <vector>
 #include <memory>
 
@@ -16,18 +21,29 @@ struct HitData {
     float t;
 };
 
-struct BVHNode {
-    GfBBox3d bbox;          // Bounding box of the node
-    const HdTemplateMesh* mesh;  // Mesh in this node (if a leaf)
-    BVHNode* left = nullptr;    // Left child node
-    BVHNode* right = nullptr;   // Right child node
+// One placement of a mesh in the world, as referenced by the top level.
+struct SceneInstance {
+    const HdTemplateMesh *mesh;
+    uint32_t instance;
 
-    // Check if the node is a leaf (contains a single mesh)
-    bool IsLeaf() const {
-        return mesh != nullptr;
+    bool operator==(const SceneInstance &other) const {
+        return mesh == other.mesh && instance == other.instance;
+    }
+    bool operator!=(const SceneInstance &other) const {
+        return !(*this == other);
     }
 };
 
+// BVH statistics of a whole scene.
+struct SceneBVHStats {
+    BVHStats topLevel;
+    // The BVHs of all meshes merged, see BVHStats::Merge. Meshes sharing
+    // their geometry count once.
+    BVHStats meshes;
+    size_t numMeshes = 0;
+    // Distinct geometries among the meshes, see MeshGeometryRegistry.
+    size_t numGeometries = 0;
+};
 
 class SceneData final {
     public:
@@ -35,22 +51,89 @@ class SceneData final {
 
         void BuildBVH();
 
+        // Swap in the mesh BVHs that finished building in the background
+        // since the last call. Must not overlap with tracing, so the renderer
+        // calls it between samples. Returns whether any BVH changed.
+        bool ApplyRefinedBVHs();
+
+        void SetBuildOptions(const BVHBuildOptions &options) {
+            _buildOptions = options;
+        }
+
+        const BVHBuildOptions &GetBuildOptions() const {
+            return _buildOptions;
+        }
+
+        // SAH cost of the last top level build, relative to the root's area.
+        float GetSAHCost() const {
+            return _bvh.GetSAHCost();
+        }
+
+        // Statistics of the top level BVH and of the mesh BVHs as currently
+        // traced. Meshes whose BVH isn't built yet count as empty. Must not
+        // overlap with Sync or BuildBVH.
+        SceneBVHStats GetBVHStats() const;
+
+        // Write GetBVHStats out as text, followed by one line per mesh, the
+        // highest SAH costs first.
+        void DumpBVHStats(std::ostream &out) const;
+
         SceneData(HdRenderIndex *index);
 
-        HitData Intersect(GfRay ray, int num_bounces);
+        // Only build the top level from visible meshes that are in
+        // collection and have one of renderTags, or any tag if renderTags is
+        // empty. Takes effect with the next BuildBVH.
+        void SetFilter(const HdRprimCollection &collection,
+                       const TfTokenVector &renderTags);
+
+        // Find the closest hit along the ray, updating closestIT in place.
+        void Intersect(const GfRay &ray, IntersectData &closestIT) const;
+
+        // Closest hits of up to RayPacketSize rays traced together, updating
+        // closestIT[i] for rays[i] in place. Meant for coherent rays, such as
+        // camera rays through a block of pixels.
+        void IntersectPacket(const GfRay *rays, int numRays, IntersectData *closestIT) const;
+
+        // Whether anything blocks the ray between tMin and tMax.
+        bool Occluded(const GfRay &ray, float tMin, float tMax) const;
 
         void SortByDepth(GfVec3f origin);
 
     private:
-        BVHNode* BuildBVHRecursive(std::vector<const HdTemplateMesh*>& meshes);
+        // Top level BVH over the world bounds of every mesh instance. Its
+        // node array is reused by every rebuild rather than reallocated.
+        BVH _bvh;
+
+        // _bvh collapsed to the wide layout that is actually traversed.
+        RenderBVH _wideBvh;
+
+        // Statistics of _bvh as of the last BuildBVH.
+        BVHStats _topLevelStats;
+
+        // Whether _meshes pass the filter, leaving out those currently
+        // invisible or with another render tag.
+        bool _IsTraced(size_t meshIndex) const;
+
+        std::vector<HdTemplateMesh*> _meshes;
 
-        IntersectData IntersectBVH(GfRay ray, BVHNode* node, IntersectData closestIT);
+        // Whether each of _meshes is in the filter's collection. Paths only
+        // change with the collection, so unlike visibility and render tags
+        // this is worked out once in SetFilter.
+        std::vector<bool> _inCollection;
+        TfTokenVector _renderTags;
 
-        GfVec4f GetCd(IntersectData it, GfRay ray, int depth);
+        // The instances with geometry, in the order they were passed to _bvh.
+        std::vector<SceneInstance> _bvhPrimInstances;
 
-        BVHNode* _bvhRoot = nullptr; // Root of the BVH
+        // The instances with geometry, in the order the BVH leaves reference
+        // them. Instances of one mesh share its BVH, so this is all the top
+        // level keeps per instance.
+        std::vector<SceneInstance> _bvhInstances;
 
-        std::vector<const HdTemplateMesh*> _meshes;
+        // Meshes are far more expensive to intersect than a node, so the top
+        // level defaults to small leaves: {numBins, minLeafSize, maxLeafSize,
+        // traversalCost, maxRefitSAHGrowth}.
+        BVHBuildOptions _buildOptions{16, 1, 4, 1.0f, 1.5f};
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
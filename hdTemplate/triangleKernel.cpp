@@ -0,0 +1,690 @@
+#include "triangleKernel.h"
+
+#include "pxr/base/tf/getenv.h"
+#include "pxr/base/tf/stringUtils.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define HDTEMPLATE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// Every kernel must produce exactly the results of IntersectTriangle, so
+// nothing in this file may be contracted into fused multiply-adds. The build
+// passes -ffp-contract=off for it; the kernels below never enable FMA either.
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+static bool _IntersectScalar(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                             const BVHRay &ray, float *tHit, uint32_t *hitIndex)
+{
+    BVHRay closest = ray;
+    bool hit = false;
+
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        float t = IntersectTriangle(tris, i, closest);
+        if (t > 0.0f)
+        {
+            closest.tMax = t;
+            *tHit = t;
+            *hitIndex = i;
+            hit = true;
+        }
+    }
+
+    return hit;
+}
+
+static bool _OccludedScalar(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                            const BVHRay &ray)
+{
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        if (IntersectTriangle(tris, i, ray) > 0.0f)
+            return true;
+    }
+    return false;
+}
+
+#ifdef HDTEMPLATE_X86_KERNELS
+
+// Pick the closest of the lanes set in hitMask, in lane order so ties resolve
+// to the lowest index exactly as the scalar loop does.
+static bool _ResolveLanes(const float *t, unsigned hitMask, uint32_t base,
+                          float *tMax, float *tHit, uint32_t *hitIndex)
+{
+    bool hit = false;
+    while (hitMask)
+    {
+        const int lane = __builtin_ctz(hitMask);
+        hitMask &= hitMask - 1;
+        if (t[lane] < *tMax)
+        {
+            *tMax = t[lane];
+            *tHit = t[lane];
+            *hitIndex = base + lane;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// Lanes of a step past the end of the run.
+static unsigned _TailMask(uint32_t remaining, int width)
+{
+    return remaining >= static_cast<uint32_t>(width) ? ~0u : (1u << remaining) - 1u;
+}
+
+// ---------------------------------------------------------------------------
+// SSE4.2, 4 triangles per step
+// ---------------------------------------------------------------------------
+
+// One coordinate of one vertex of the 4 quantized records from base on,
+// decoded as TriangleRecords::Decode does.
+__attribute__((target("sse4.2")))
+static __m128 _DecodeSSE(const TriangleRecords &tris, int vertex, int axis, uint32_t base)
+{
+    const __m128 steps = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(tris.q[vertex][axis].data() + base))));
+    return _mm_add_ps(_mm_set1_ps(tris.origin[axis]), _mm_mul_ps(_mm_set1_ps(tris.step[axis]), steps));
+}
+
+// The first vertex and the edges of the 4 records from base on, of
+// either kind, as TriangleRecords::GetVertexAndEdges returns them.
+__attribute__((target("sse4.2")))
+static void _LoadSSE(const TriangleRecords &tris, uint32_t base, __m128 *v0, __m128 *e1, __m128 *e2)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        if (tris.quantized)
+        {
+            v0[a] = _DecodeSSE(tris, 0, a, base);
+            e1[a] = _mm_sub_ps(_DecodeSSE(tris, 1, a, base), v0[a]);
+            e2[a] = _mm_sub_ps(_DecodeSSE(tris, 2, a, base), v0[a]);
+        }
+        else
+        {
+            v0[a] = _mm_loadu_ps(tris.v0[a].data() + base);
+            e1[a] = _mm_loadu_ps(tris.e1[a].data() + base);
+            e2[a] = _mm_loadu_ps(tris.e2[a].data() + base);
+        }
+    }
+}
+
+__attribute__((target("sse4.2")))
+static unsigned _TestSSE(const TriangleRecords &tris, uint32_t base, const BVHRay &ray,
+                         float tMax, float *tOut)
+{
+    const __m128 dx = _mm_set1_ps(ray.direction[0]);
+    const __m128 dy = _mm_set1_ps(ray.direction[1]);
+    const __m128 dz = _mm_set1_ps(ray.direction[2]);
+
+    __m128 v0[3], e1[3], e2[3];
+    _LoadSSE(tris, base, v0, e1, e2);
+
+    const __m128 e1x = e1[0], e1y = e1[1], e1z = e1[2];
+    const __m128 e2x = e2[0], e2y = e2[1], e2z = e2[2];
+
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    const __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), v0[0]);
+    const __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), v0[1]);
+    const __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), v0[2]);
+
+    const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+    const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+
+    __m128 mask = _mm_cmpge_ps(absDet, _mm_set1_ps(TriangleDetEpsilon));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_set1_ps(ray.tMin)));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+
+    _mm_storeu_ps(tOut, t);
+    return static_cast<unsigned>(_mm_movemask_ps(mask));
+}
+
+__attribute__((target("sse4.2")))
+static bool _IntersectSSE(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                          const BVHRay &ray, float *tHit, uint32_t *hitIndex)
+{
+    float tMax = ray.tMax;
+    bool hit = false;
+    float t[4];
+
+    for (uint32_t base = first; base < first + count; base += 4)
+    {
+        unsigned mask = _TestSSE(tris, base, ray, tMax, t) & _TailMask(first + count - base, 4);
+        hit |= _ResolveLanes(t, mask, base, &tMax, tHit, hitIndex);
+    }
+    return hit;
+}
+
+__attribute__((target("sse4.2")))
+static bool _OccludedSSE(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                         const BVHRay &ray)
+{
+    float t[4];
+    for (uint32_t base = first; base < first + count; base += 4)
+    {
+        if (_TestSSE(tris, base, ray, ray.tMax, t) & _TailMask(first + count - base, 4))
+            return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// AVX2, 8 triangles per step
+// ---------------------------------------------------------------------------
+
+// One coordinate of one vertex of the 8 quantized records from base on,
+// decoded as TriangleRecords::Decode does.
+__attribute__((target("avx2")))
+static __m256 _DecodeAVX2(const TriangleRecords &tris, int vertex, int axis, uint32_t base)
+{
+    const __m256 steps = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(tris.q[vertex][axis].data() + base))));
+    return _mm256_add_ps(_mm256_set1_ps(tris.origin[axis]), _mm256_mul_ps(_mm256_set1_ps(tris.step[axis]), steps));
+}
+
+// The first vertex and the edges of the 8 records from base on, of
+// either kind, as TriangleRecords::GetVertexAndEdges returns them.
+__attribute__((target("avx2")))
+static void _LoadAVX2(const TriangleRecords &tris, uint32_t base, __m256 *v0, __m256 *e1, __m256 *e2)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        if (tris.quantized)
+        {
+            v0[a] = _DecodeAVX2(tris, 0, a, base);
+            e1[a] = _mm256_sub_ps(_DecodeAVX2(tris, 1, a, base), v0[a]);
+            e2[a] = _mm256_sub_ps(_DecodeAVX2(tris, 2, a, base), v0[a]);
+        }
+        else
+        {
+            v0[a] = _mm256_loadu_ps(tris.v0[a].data() + base);
+            e1[a] = _mm256_loadu_ps(tris.e1[a].data() + base);
+            e2[a] = _mm256_loadu_ps(tris.e2[a].data() + base);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static unsigned _TestAVX2(const TriangleRecords &tris, uint32_t base, const BVHRay &ray,
+                          float tMax, float *tOut)
+{
+    const __m256 dx = _mm256_set1_ps(ray.direction[0]);
+    const __m256 dy = _mm256_set1_ps(ray.direction[1]);
+    const __m256 dz = _mm256_set1_ps(ray.direction[2]);
+
+    __m256 v0[3], e1[3], e2[3];
+    _LoadAVX2(tris, base, v0, e1, e2);
+
+    const __m256 e1x = e1[0], e1y = e1[1], e1z = e1[2];
+    const __m256 e2x = e2[0], e2y = e2[1], e2z = e2[2];
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), v0[0]);
+    const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), v0[1]);
+    const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), v0[2]);
+
+    const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+    const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+
+    __m256 mask = _mm256_cmp_ps(absDet, _mm256_set1_ps(TriangleDetEpsilon), _CMP_GE_OQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(ray.tMin), _CMP_GT_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+
+    _mm256_storeu_ps(tOut, t);
+    return static_cast<unsigned>(_mm256_movemask_ps(mask));
+}
+
+__attribute__((target("avx2")))
+static bool _IntersectAVX2(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                           const BVHRay &ray, float *tHit, uint32_t *hitIndex)
+{
+    float tMax = ray.tMax;
+    bool hit = false;
+    float t[8];
+
+    for (uint32_t base = first; base < first + count; base += 8)
+    {
+        unsigned mask = _TestAVX2(tris, base, ray, tMax, t) & _TailMask(first + count - base, 8);
+        hit |= _ResolveLanes(t, mask, base, &tMax, tHit, hitIndex);
+    }
+    return hit;
+}
+
+__attribute__((target("avx2")))
+static bool _OccludedAVX2(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                          const BVHRay &ray)
+{
+    float t[8];
+    for (uint32_t base = first; base < first + count; base += 8)
+    {
+        if (_TestAVX2(tris, base, ray, ray.tMax, t) & _TailMask(first + count - base, 8))
+            return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// AVX-512, 16 triangles per step
+// ---------------------------------------------------------------------------
+
+// One coordinate of one vertex of the 16 quantized records from base on,
+// decoded as TriangleRecords::Decode does.
+__attribute__((target("avx512f")))
+static __m512 _DecodeAVX512(const TriangleRecords &tris, int vertex, int axis, uint32_t base)
+{
+    const __m512 steps = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(tris.q[vertex][axis].data() + base))));
+    return _mm512_add_ps(_mm512_set1_ps(tris.origin[axis]), _mm512_mul_ps(_mm512_set1_ps(tris.step[axis]), steps));
+}
+
+// The first vertex and the edges of the 16 records from base on, of
+// either kind, as TriangleRecords::GetVertexAndEdges returns them.
+__attribute__((target("avx512f")))
+static void _LoadAVX512(const TriangleRecords &tris, uint32_t base, __m512 *v0, __m512 *e1, __m512 *e2)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        if (tris.quantized)
+        {
+            v0[a] = _DecodeAVX512(tris, 0, a, base);
+            e1[a] = _mm512_sub_ps(_DecodeAVX512(tris, 1, a, base), v0[a]);
+            e2[a] = _mm512_sub_ps(_DecodeAVX512(tris, 2, a, base), v0[a]);
+        }
+        else
+        {
+            v0[a] = _mm512_loadu_ps(tris.v0[a].data() + base);
+            e1[a] = _mm512_loadu_ps(tris.e1[a].data() + base);
+            e2[a] = _mm512_loadu_ps(tris.e2[a].data() + base);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static unsigned _TestAVX512(const TriangleRecords &tris, uint32_t base, const BVHRay &ray,
+                            float tMax, float *tOut)
+{
+    const __m512 dx = _mm512_set1_ps(ray.direction[0]);
+    const __m512 dy = _mm512_set1_ps(ray.direction[1]);
+    const __m512 dz = _mm512_set1_ps(ray.direction[2]);
+
+    __m512 v0[3], e1[3], e2[3];
+    _LoadAVX512(tris, base, v0, e1, e2);
+
+    const __m512 e1x = e1[0], e1y = e1[1], e1z = e1[2];
+    const __m512 e2x = e2[0], e2y = e2[1], e2z = e2[2];
+
+    const __m512 px = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+    const __m512 py = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+    const __m512 pz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+
+    const __m512 det = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e1x, px), _mm512_mul_ps(e1y, py)), _mm512_mul_ps(e1z, pz));
+    const __m512 invDet = _mm512_div_ps(_mm512_set1_ps(1.0f), det);
+
+    const __m512 sx = _mm512_sub_ps(_mm512_set1_ps(ray.origin[0]), v0[0]);
+    const __m512 sy = _mm512_sub_ps(_mm512_set1_ps(ray.origin[1]), v0[1]);
+    const __m512 sz = _mm512_sub_ps(_mm512_set1_ps(ray.origin[2]), v0[2]);
+
+    const __m512 u = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(sx, px), _mm512_mul_ps(sy, py)), _mm512_mul_ps(sz, pz)), invDet);
+
+    const __m512 qx = _mm512_sub_ps(_mm512_mul_ps(sy, e1z), _mm512_mul_ps(sz, e1y));
+    const __m512 qy = _mm512_sub_ps(_mm512_mul_ps(sz, e1x), _mm512_mul_ps(sx, e1z));
+    const __m512 qz = _mm512_sub_ps(_mm512_mul_ps(sx, e1y), _mm512_mul_ps(sy, e1x));
+
+    const __m512 v = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, qx), _mm512_mul_ps(dy, qy)), _mm512_mul_ps(dz, qz)), invDet);
+    const __m512 t = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(e2x, qx), _mm512_mul_ps(e2y, qy)), _mm512_mul_ps(e2z, qz)), invDet);
+
+    const __m512 zero = _mm512_setzero_ps();
+
+    __mmask16 mask = _mm512_cmp_ps_mask(_mm512_abs_ps(det), _mm512_set1_ps(TriangleDetEpsilon), _CMP_GE_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, u, zero, _CMP_GE_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, v, zero, _CMP_GE_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, _mm512_add_ps(u, v), _mm512_set1_ps(1.0f), _CMP_LE_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, t, _mm512_set1_ps(ray.tMin), _CMP_GT_OQ);
+    mask = _mm512_mask_cmp_ps_mask(mask, t, _mm512_set1_ps(tMax), _CMP_LT_OQ);
+
+    _mm512_storeu_ps(tOut, t);
+    return static_cast<unsigned>(mask);
+}
+
+__attribute__((target("avx512f")))
+static bool _IntersectAVX512(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                             const BVHRay &ray, float *tHit, uint32_t *hitIndex)
+{
+    float tMax = ray.tMax;
+    bool hit = false;
+    float t[16];
+
+    for (uint32_t base = first; base < first + count; base += 16)
+    {
+        unsigned mask = _TestAVX512(tris, base, ray, tMax, t) & _TailMask(first + count - base, 16);
+        hit |= _ResolveLanes(t, mask, base, &tMax, tHit, hitIndex);
+    }
+    return hit;
+}
+
+__attribute__((target("avx512f")))
+static bool _OccludedAVX512(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                            const BVHRay &ray)
+{
+    float t[16];
+    for (uint32_t base = first; base < first + count; base += 16)
+    {
+        if (_TestAVX512(tris, base, ray, ray.tMax, t) & _TailMask(first + count - base, 16))
+            return true;
+    }
+    return false;
+}
+
+#endif // HDTEMPLATE_X86_KERNELS
+
+static const TriangleKernel _kernels[] = {
+#ifdef HDTEMPLATE_X86_KERNELS
+    {"avx512", 16, _IntersectAVX512, _OccludedAVX512},
+    {"avx2", 8, _IntersectAVX2, _OccludedAVX2},
+    {"sse4.2", 4, _IntersectSSE, _OccludedSSE},
+#endif
+    {"scalar", 1, _IntersectScalar, _OccludedScalar},
+};
+
+static bool _IsSupported(const TriangleKernel &kernel)
+{
+#ifdef HDTEMPLATE_X86_KERNELS
+    if (std::strcmp(kernel.name, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+    if (std::strcmp(kernel.name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (std::strcmp(kernel.name, "sse4.2") == 0)
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    return true;
+}
+
+const TriangleKernel *GetTriangleKernel(const char *name)
+{
+    for (const TriangleKernel &kernel : _kernels)
+    {
+        if (std::strcmp(kernel.name, name) == 0)
+            return _IsSupported(kernel) ? &kernel : nullptr;
+    }
+    return nullptr;
+}
+
+// Triangles around the origin for CheckTriangleKernel, mixing ones rays
+// can pass through with the degenerate kinds the kernels must all miss.
+static TriangleRecords _MakeCheckTriangles(std::mt19937 &random)
+{
+    std::uniform_real_distribution<float> coordinate(-1.0f, 1.0f);
+    auto randomPoint = [&]()
+    {
+        return GfVec3f(coordinate(random), coordinate(random), coordinate(random));
+    };
+
+    std::vector<GfVec3f> points;
+    for (int i = 0; i < 40; ++i)
+    {
+        points.push_back(randomPoint());
+        points.push_back(randomPoint());
+        points.push_back(randomPoint());
+    }
+
+    // The same triangle twice, so ties have to go to the lower index.
+    points.insert(points.end(), points.begin(), points.begin() + 3);
+
+    // Axis aligned, so axis aligned rays lie in their planes or hit their
+    // edges exactly.
+    points.insert(points.end(), {GfVec3f(0, 0, 0), GfVec3f(1, 0, 0), GfVec3f(0, 1, 0)});
+    points.insert(points.end(), {GfVec3f(0, 0, 0), GfVec3f(0, 0, 1), GfVec3f(1, 0, 0)});
+
+    // Degenerate: collinear, two coincident points, all coincident, tiny.
+    points.insert(points.end(), {GfVec3f(0, 0, 0), GfVec3f(1, 1, 1), GfVec3f(2, 2, 2)});
+    points.insert(points.end(), {GfVec3f(0.5f, 0, 0), GfVec3f(0.5f, 0, 0), GfVec3f(0, 1, 0)});
+    points.insert(points.end(), {GfVec3f(0.25f), GfVec3f(0.25f), GfVec3f(0.25f)});
+    points.insert(points.end(), {GfVec3f(0, 0, 0), GfVec3f(1e-7f, 0, 0), GfVec3f(0, 1e-7f, 0)});
+
+    TriangleRecords tris;
+    tris.Resize(points.size() / 3);
+    for (size_t i = 0; i < tris.size(); ++i)
+    {
+        tris.Set(i, points[3 * i], points[3 * i + 1], points[3 * i + 2]);
+    }
+    return tris;
+}
+
+// The check triangles as quantized records, on a grid coarse enough that
+// the tiny one collapses too.
+static TriangleRecords _QuantizeCheckTriangles(const TriangleRecords &tris)
+{
+    const GfVec3f origin(-2.0f);
+    const GfVec3f step(4.0f / 65535.0f);
+
+    TriangleRecords quantized;
+    quantized.ResizeQuantized(tris.size(), origin, step);
+    for (size_t i = 0; i < tris.size(); ++i)
+    {
+        GfVec3f v0, e1, e2;
+        tris.GetVertexAndEdges(i, &v0, &e1, &e2);
+        const GfVec3f points[3] = {v0, v0 + e1, v0 + e2};
+
+        uint16_t q[3][3];
+        for (int j = 0; j < 3; ++j)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                q[j][a] = static_cast<uint16_t>(std::lround((points[j][a] - origin[a]) / step[a]));
+            }
+        }
+        quantized.SetQuantized(i, q[0], q[1], q[2]);
+    }
+    return quantized;
+}
+
+// A ray for CheckTriangleKernel. Most are aimed at a point of one of the
+// triangles, often on its edges or vertices; the rest are random, axis
+// aligned or lie in a triangle's plane.
+static BVHRay _MakeCheckRay(std::mt19937 &random, const TriangleRecords &tris)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> coordinate(-2.0f, 2.0f);
+    auto randomPoint = [&]()
+    {
+        return GfVec3f(coordinate(random), coordinate(random), coordinate(random));
+    };
+
+    const size_t i = random() % tris.size();
+    GfVec3f v0, e1, e2;
+    tris.GetVertexAndEdges(i, &v0, &e1, &e2);
+
+    float u = unit(random);
+    float v = unit(random) * (1.0f - u);
+    switch (random() % 6)
+    {
+    case 0: u = 0.0f; break;
+    case 1: v = 0.0f; break;
+    case 2: v = 1.0f - u; break;
+    case 3: u = static_cast<float>(random() % 2); v = 0.0f; break;
+    default: break;
+    }
+    const GfVec3f target = v0 + e1 * u + e2 * v;
+
+    GfVec3f origin = randomPoint();
+    GfVec3f direction = target - origin;
+    switch (random() % 8)
+    {
+    case 0:
+        direction = randomPoint();
+        break;
+    case 1:
+    {
+        // Along an axis, with the other components exactly zero.
+        const int axis = random() % 3;
+        direction = GfVec3f(0.0f);
+        direction[axis] = random() % 2 ? 1.0f : -1.0f;
+        origin = target - direction * 3.0f;
+        break;
+    }
+    case 2:
+        // Within the plane of the triangle, through the target point.
+        direction = e1 * unit(random) - e2 * unit(random);
+        origin = target - direction;
+        break;
+    default:
+        break;
+    }
+
+    float tMin = 0.0f;
+    float tMax = std::numeric_limits<float>::infinity();
+    if (random() % 4 == 0)
+    {
+        tMin = unit(random);
+        tMax = tMin + unit(random) * 2.0f;
+    }
+    return BVHRay(origin, direction,
+                  GfVec3f(1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]),
+                  tMin, tMax);
+}
+
+bool CheckTriangleKernel(const TriangleKernel &kernel, std::string *error)
+{
+    std::mt19937 random(42);
+    const TriangleRecords floatTris = _MakeCheckTriangles(random);
+    const TriangleRecords quantizedTris = _QuantizeCheckTriangles(floatTris);
+    const uint32_t numTris = static_cast<uint32_t>(floatTris.size());
+
+    auto check = [&](const TriangleRecords &tris, const BVHRay &ray,
+                     uint32_t first, uint32_t count)
+    {
+        float expectedT = 0.0f, t = 0.0f;
+        uint32_t expectedIndex = 0, index = 0;
+        const bool expectedHit = _IntersectScalar(tris, first, count, ray, &expectedT, &expectedIndex);
+        const bool hit = kernel.intersect(tris, first, count, ray, &t, &index);
+
+        bool same = hit == expectedHit &&
+                    kernel.occluded(tris, first, count, ray) == expectedHit;
+        if (same && hit)
+        {
+            same = index == expectedIndex && std::memcmp(&t, &expectedT, sizeof(t)) == 0;
+        }
+
+        if (!same && error)
+        {
+            *error = TfStringPrintf(
+                "%s records [%u, %u), origin (%a, %a, %a), direction (%a, %a, %a), "
+                "t (%a, %a): %s hit %d at %u t %a, scalar hit %d at %u t %a",
+                tris.quantized ? "quantized" : "float", first, first + count,
+                ray.origin[0], ray.origin[1], ray.origin[2],
+                ray.direction[0], ray.direction[1], ray.direction[2],
+                ray.tMin, ray.tMax,
+                kernel.name, hit, index, t, expectedHit, expectedIndex, expectedT);
+        }
+        return same;
+    };
+
+    for (const TriangleRecords *tris : {&floatTris, &quantizedTris})
+    {
+        for (int i = 0; i < 4096; ++i)
+        {
+            const BVHRay ray = _MakeCheckRay(random, *tris);
+
+            if (!check(*tris, ray, 0, numTris))
+                return false;
+
+            // Runs of every length up to the widest kernel's step that end
+            // at the last record, so that their last step reads the padding.
+            for (uint32_t count = 1; count <= TriangleRecords::Padding; ++count)
+            {
+                if (!check(*tris, ray, numTris - count, count))
+                    return false;
+            }
+
+            const uint32_t first = random() % numTris;
+            if (!check(*tris, ray, first, 1 + random() % (numTris - first)))
+                return false;
+        }
+    }
+    return true;
+}
+
+static const TriangleKernel &_SelectTriangleKernel()
+{
+    const std::string forced = TfGetenv("HDTEMPLATE_TRIANGLE_KERNEL");
+    if (forced == "check")
+    {
+        // The table is ordered widest first.
+        for (const TriangleKernel &kernel : _kernels)
+        {
+            if (!_IsSupported(kernel))
+                continue;
+
+            std::string error;
+            if (CheckTriangleKernel(kernel, &error))
+                return kernel;
+            TF_WARN("Triangle kernel '%s' differs from the scalar one, %s",
+                    kernel.name, error.c_str());
+        }
+        return _kernels[sizeof(_kernels) / sizeof(_kernels[0]) - 1];
+    }
+    if (!forced.empty())
+    {
+        if (const TriangleKernel *kernel = GetTriangleKernel(forced.c_str()))
+            return *kernel;
+        TF_WARN("Triangle kernel '%s' is unavailable on this CPU, "
+                "picking one automatically", forced.c_str());
+    }
+
+    // The table is ordered widest first.
+    for (const TriangleKernel &kernel : _kernels)
+    {
+        if (_IsSupported(kernel))
+            return kernel;
+    }
+    return _kernels[sizeof(_kernels) / sizeof(_kernels[0]) - 1];
+}
+
+const TriangleKernel &GetTriangleKernel()
+{
+    static const TriangleKernel &kernel = _SelectTriangleKernel();
+    return kernel;
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
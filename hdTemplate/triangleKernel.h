@@ -0,0 +1,53 @@
+#pragma once
+
+#include "pxr/pxr.h"
+
+#include "bvh.h"
+#include "triangles.h"
+
+#include <cstdint>
+#include <string>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Ray/triangle kernels that test a run of TriangleRecords several triangles
+// at a time. Every implementation returns bit for bit the same result as
+// looping IntersectTriangle over the run.
+struct TriangleKernel {
+    // ISA the kernel was compiled for: "scalar", "sse4.2", "avx2" or "avx512".
+    const char *name;
+
+    // Number of triangles tested per step.
+    int width;
+
+    // Closest hit among records [first, first + count) inside
+    // (ray.tMin, ray.tMax). On a hit writes its distance and record index and
+    // returns true; ties go to the lowest index.
+    bool (*intersect)(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                      const BVHRay &ray, float *tHit, uint32_t *hitIndex);
+
+    // Whether any of the records is hit inside (ray.tMin, ray.tMax).
+    bool (*occluded)(const TriangleRecords &tris, uint32_t first, uint32_t count,
+                     const BVHRay &ray);
+};
+
+// The widest kernel the CPU supports, picked on first use. Setting
+// HDTEMPLATE_TRIANGLE_KERNEL to one of the kernel names forces a narrower one.
+// Setting it to "check" runs CheckTriangleKernel on every supported kernel
+// first, warns about any that fail and picks the widest one that passes.
+const TriangleKernel &GetTriangleKernel();
+
+// The kernel for a given name, or nullptr if it wasn't compiled in or the CPU
+// can't run it.
+const TriangleKernel *GetTriangleKernel(const char *name);
+
+// Compare kernel against the scalar loop over a fixed set of randomized and
+// edge case rays and triangles: rays hitting edges and vertices, rays in the
+// plane of a triangle, degenerate and duplicate triangles, clipped tMin and
+// tMax, and runs of every length that end in the zeroed padding, over both
+// float and quantized records. Hits must
+// agree on their record index and on every bit of their distance. Returns
+// false on the first mismatch, describing it in error if given.
+bool CheckTriangleKernel(const TriangleKernel &kernel, std::string *error = nullptr);
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "pxr/pxr.h"
+#include "pxr/base/gf/vec3f.h"
+
+#include "bvh.h"
+#include "mappedStorage.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// World space triangles stored as structure of arrays: the first vertex and
+// the two edges leaving it. Records are kept in BVH leaf order so a leaf is a
+// contiguous run that can be streamed through without any indirection.
+//
+// Quantized records instead keep the three vertices as 16 bit steps of step
+// from origin, the way CompactMesh stores quantized points, in half the
+// memory. The vertex and edges are decoded as they're tested, by every
+// kernel alike; see GetVertexAndEdges.
+struct TriangleRecords {
+    // Zeroed records past the end, so SIMD kernels can always load full
+    // vectors and mask off the unused lanes.
+    static constexpr size_t Padding = 16;
+
+    MappedVector<float> v0[3];
+    MappedVector<float> e1[3];
+    MappedVector<float> e2[3];
+
+    // Quantized records, by vertex and then axis.
+    MappedVector<uint16_t> q[3][3];
+    GfVec3f origin{0.0f};
+    GfVec3f step{0.0f};
+    bool quantized = false;
+
+    size_t count = 0;
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t GetMemorySize() const {
+        size_t bytes = 0;
+        for (int i = 0; i < 3; ++i) {
+            bytes += (v0[i].capacity() + e1[i].capacity() + e2[i].capacity()) * sizeof(float);
+            for (int j = 0; j < 3; ++j) {
+                bytes += q[i][j].capacity() * sizeof(uint16_t);
+            }
+        }
+        return bytes;
+    }
+
+    void Clear() {
+        Resize(0);
+    }
+
+    void Resize(size_t newCount) {
+        count = newCount;
+        quantized = false;
+        for (int i = 0; i < 3; ++i) {
+            v0[i].assign(count + Padding, 0.0f);
+            e1[i].assign(count + Padding, 0.0f);
+            e2[i].assign(count + Padding, 0.0f);
+            for (int j = 0; j < 3; ++j) {
+                MappedVector<uint16_t>().swap(q[i][j]);
+            }
+        }
+    }
+
+    // Make room for newCount quantized records, decoded relative to
+    // quantizedOrigin and quantizedStep.
+    void ResizeQuantized(size_t newCount, const GfVec3f &quantizedOrigin,
+                         const GfVec3f &quantizedStep) {
+        count = newCount;
+        quantized = true;
+        origin = quantizedOrigin;
+        step = quantizedStep;
+        for (int i = 0; i < 3; ++i) {
+            MappedVector<float>().swap(v0[i]);
+            MappedVector<float>().swap(e1[i]);
+            MappedVector<float>().swap(e2[i]);
+            for (int j = 0; j < 3; ++j) {
+                q[i][j].assign(count + Padding, 0);
+            }
+        }
+    }
+
+    void Set(size_t index, const GfVec3f &p0, const GfVec3f &p1, const GfVec3f &p2) {
+        for (int i = 0; i < 3; ++i) {
+            v0[i][index] = p0[i];
+            e1[i][index] = p1[i] - p0[i];
+            e2[i][index] = p2[i] - p0[i];
+        }
+    }
+
+    // Set a quantized record from the three steps per axis of each vertex.
+    void SetQuantized(size_t index, const uint16_t *q0, const uint16_t *q1, const uint16_t *q2) {
+        for (int a = 0; a < 3; ++a) {
+            q[0][a][index] = q0[a];
+            q[1][a][index] = q1[a];
+            q[2][a][index] = q2[a];
+        }
+    }
+
+    // Copy record fromIndex of another set of records of the same kind, and
+    // quantized relative to the same origin and step, as is.
+    void Copy(size_t index, const TriangleRecords &from, size_t fromIndex) {
+        if (quantized) {
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) {
+                    q[i][j][index] = from.q[i][j][fromIndex];
+                }
+            }
+            return;
+        }
+        for (int i = 0; i < 3; ++i) {
+            v0[i][index] = from.v0[i][fromIndex];
+            e1[i][index] = from.e1[i][fromIndex];
+            e2[i][index] = from.e2[i][fromIndex];
+        }
+    }
+
+    // Coordinate of a quantized vertex, exactly as CompactMesh::GetPoint
+    // and the SIMD kernels decode it.
+    float Decode(int vertex, int axis, size_t index) const {
+        return origin[axis] + step[axis] * q[vertex][axis][index];
+    }
+
+    // The first vertex and the two edges of a record, whichever kind.
+    void GetVertexAndEdges(size_t index, GfVec3f *vertex, GfVec3f *edge1, GfVec3f *edge2) const {
+        if (quantized) {
+            for (int a = 0; a < 3; ++a) {
+                const float p0 = Decode(0, a, index);
+                (*vertex)[a] = p0;
+                (*edge1)[a] = Decode(1, a, index) - p0;
+                (*edge2)[a] = Decode(2, a, index) - p0;
+            }
+            return;
+        }
+        for (int a = 0; a < 3; ++a) {
+            (*vertex)[a] = v0[a][index];
+            (*edge1)[a] = e1[a][index];
+            (*edge2)[a] = e2[a][index];
+        }
+    }
+
+    // Geometric normal of a triangle, facing back towards the ray.
+    GfVec3f GetNormal(size_t index, const GfVec3f &direction) const {
+        GfVec3f p, a, b;
+        GetVertexAndEdges(index, &p, &a, &b);
+        GfVec3f n(a[1] * b[2] - a[2] * b[1],
+                  a[2] * b[0] - a[0] * b[2],
+                  a[0] * b[1] - a[1] * b[0]);
+        if (n * direction > 0.0f)
+            n = -n;
+        return n.GetNormalized();
+    }
+};
+
+// Determinants smaller than this are treated as rays parallel to the triangle.
+static constexpr float TriangleDetEpsilon = 1e-12f;
+
+// Möller-Trumbore test of one record. Returns the hit distance, or a negative
+// value when the ray misses or the hit lies outside (ray.tMin, ray.tMax).
+//
+// This is the reference the SIMD kernels in triangleKernel.cpp must match bit
+// for bit, so they evaluate the same expressions in the same order.
+inline float IntersectTriangle(const TriangleRecords &tris, size_t i, const BVHRay &ray)
+{
+    GfVec3f v0, e1, e2;
+    tris.GetVertexAndEdges(i, &v0, &e1, &e2);
+
+    const float e1x = e1[0], e1y = e1[1], e1z = e1[2];
+    const float e2x = e2[0], e2y = e2[1], e2z = e2[2];
+
+    const float dx = ray.direction[0], dy = ray.direction[1], dz = ray.direction[2];
+
+    // p = d x e2
+    const float px = dy * e2z - dz * e2y;
+    const float py = dz * e2x - dx * e2z;
+    const float pz = dx * e2y - dy * e2x;
+
+    const float det = e1x * px + e1y * py + e1z * pz;
+    const float invDet = 1.0f / det;
+
+    const float sx = ray.origin[0] - v0[0];
+    const float sy = ray.origin[1] - v0[1];
+    const float sz = ray.origin[2] - v0[2];
+
+    const float u = (sx * px + sy * py + sz * pz) * invDet;
+
+    // q = s x e1
+    const float qx = sy * e1z - sz * e1y;
+    const float qy = sz * e1x - sx * e1z;
+    const float qz = sx * e1y - sy * e1x;
+
+    const float v = (dx * qx + dy * qy + dz * qz) * invDet;
+    const float t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+    // Written as conditions for a hit so NaNs from degenerate input miss.
+    const bool hit = std::abs(det) >= TriangleDetEpsilon &&
+                     u >= 0.0f && v >= 0.0f && u + v <= 1.0f &&
+                     t > ray.tMin && t < ray.tMax;
+
+    return hit ? t : -1.0f;
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
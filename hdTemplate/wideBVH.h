@@ -0,0 +1,774 @@
+#pragma once
+
+#include "pxr/pxr.h"
+
+#include "bvh.h"
+#include "mappedStorage.h"
+#include "rayPacket.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Branching factor of the wide BVHs traversed by the renderer, 4 or 8. Set by
+// the build (HDTEMPLATE_BVH_WIDTH in CMake); 8 pays off when compiling for AVX.
+#ifndef HDTEMPLATE_BVH_WIDTH
+#define HDTEMPLATE_BVH_WIDTH 4
+#endif
+
+// Whether the renderer's wide BVHs store quantized child bounds. Set by the
+// build (HDTEMPLATE_BVH_QUANTIZED in CMake).
+#ifndef HDTEMPLATE_BVH_QUANTIZED
+#define HDTEMPLATE_BVH_QUANTIZED 0
+#endif
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// A node of an N-ary BVH. Child bounds are stored as structure of arrays so a
+// single SIMD slab test covers every child at once.
+template <int N>
+struct alignas(64) WideBVHNode {
+    static constexpr uint32_t MaxLeafCount = std::numeric_limits<uint32_t>::max();
+
+    // Rows are min x, min y, min z, max x, max y, max z; one column per child.
+    // Unused slots hold inverted, infinite bounds that every ray misses.
+    float bounds[6][N];
+    // Index of the child node, or the first primitive for a leaf child.
+    uint32_t child[N];
+    // Number of primitives of a leaf child, zero for inner children.
+    uint32_t count[N];
+
+    void Init(const BVHBounds &) {
+        for (int i = 0; i < N; ++i) {
+            for (int a = 0; a < 3; ++a) {
+                bounds[a][i] = std::numeric_limits<float>::infinity();
+                bounds[a + 3][i] = -std::numeric_limits<float>::infinity();
+            }
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+
+    void SetChild(int i, const BVHBounds &b, uint32_t childIndex, uint32_t primCount) {
+        for (int a = 0; a < 3; ++a) {
+            bounds[a][i] = b.min[a];
+            bounds[a + 3][i] = b.max[a];
+        }
+        child[i] = childIndex;
+        count[i] = primCount;
+    }
+
+    // Bounds of one child, rows as in the bounds member.
+    void GetChildBounds(int i, float out[6]) const {
+        for (int a = 0; a < 6; ++a) {
+            out[a] = bounds[a][i];
+        }
+    }
+};
+
+static_assert(sizeof(WideBVHNode<4>) == 128, "WideBVHNode<4> should be 128 bytes");
+static_assert(sizeof(WideBVHNode<8>) == 256, "WideBVHNode<8> should be 256 bytes");
+
+// A node of an N-ary BVH with child bounds quantized to 8 bits against the
+// node's own bounds, at half the size of WideBVHNode. The grid spacing on
+// each axis is a power of two, so decoding is cheap and the decoded bounds
+// always enclose the real ones.
+template <int N>
+struct alignas(64) QuantizedWideBVHNode {
+    // Larger leaves are spread over several slots when collapsing.
+    static constexpr uint32_t MaxLeafCount = std::numeric_limits<uint8_t>::max();
+
+    // Corner of the grid and log2 of its spacing on each axis.
+    float origin[3];
+    int8_t exponent[3];
+    // Slots from this one on are unused.
+    uint8_t numChildren;
+    // Grid coordinates, laid out like WideBVHNode::bounds.
+    uint8_t bounds[6][N];
+    // Index of the child node, or the first primitive for a leaf child.
+    uint32_t child[N];
+    // Number of primitives of a leaf child, zero for inner children.
+    uint8_t count[N];
+
+    void Init(const BVHBounds &nodeBounds) {
+        for (int a = 0; a < 3; ++a) {
+            origin[a] = nodeBounds.min[a];
+
+            // Smallest power of two spacing whose 255 steps reach the max.
+            const float extent = nodeBounds.max[a] - nodeBounds.min[a];
+            int e = extent > 0.0f ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+            e = std::max(e, -126);
+            while (e < 127 && origin[a] + 255.0f * std::ldexp(1.0f, e) < nodeBounds.max[a])
+                ++e;
+            exponent[a] = static_cast<int8_t>(e);
+        }
+
+        numChildren = 0;
+        for (int i = 0; i < N; ++i) {
+            for (int a = 0; a < 6; ++a) {
+                bounds[a][i] = 0;
+            }
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+
+    // Slots have to be filled in order.
+    void SetChild(int i, const BVHBounds &b, uint32_t childIndex, uint32_t primCount) {
+        for (int a = 0; a < 3; ++a) {
+            const float scale = std::ldexp(1.0f, exponent[a]);
+
+            // Round outwards, then step further out wherever the decoder's
+            // float arithmetic would still land inside the box.
+            float lo = std::floor((b.min[a] - origin[a]) / scale);
+            lo = std::min(std::max(lo, 0.0f), 255.0f);
+            while (lo > 0.0f && origin[a] + lo * scale > b.min[a])
+                lo -= 1.0f;
+
+            float hi = std::ceil((b.max[a] - origin[a]) / scale);
+            hi = std::min(std::max(hi, 0.0f), 255.0f);
+            while (hi < 255.0f && origin[a] + hi * scale < b.max[a])
+                hi += 1.0f;
+
+            bounds[a][i] = static_cast<uint8_t>(lo);
+            bounds[a + 3][i] = static_cast<uint8_t>(hi);
+        }
+        child[i] = childIndex;
+        count[i] = static_cast<uint8_t>(primCount);
+        numChildren = static_cast<uint8_t>(std::max(static_cast<int>(numChildren), i + 1));
+    }
+
+    // Decoded bounds of one child, rows as in WideBVHNode::bounds. Unused
+    // slots come back inverted and infinite, like WideBVHNode's.
+    void GetChildBounds(int i, float out[6]) const {
+        for (int a = 0; a < 3; ++a) {
+            if (i < numChildren) {
+                const float scale = std::ldexp(1.0f, exponent[a]);
+                out[a] = origin[a] + bounds[a][i] * scale;
+                out[a + 3] = origin[a] + bounds[a + 3][i] * scale;
+            } else {
+                out[a] = std::numeric_limits<float>::infinity();
+                out[a + 3] = -std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+};
+
+static_assert(sizeof(QuantizedWideBVHNode<4>) == 64, "QuantizedWideBVHNode<4> should be 64 bytes");
+static_assert(sizeof(QuantizedWideBVHNode<8>) == 128, "QuantizedWideBVHNode<8> should be 128 bytes");
+
+// Precomputed per ray: which bounds row is entered first on each axis. Picking
+// it from the sign of the direction makes inverted bounds a guaranteed miss.
+struct WideBVHRayOctant {
+    explicit WideBVHRayOctant(const BVHRay &ray) {
+        for (int a = 0; a < 3; ++a) {
+            nearRow[a] = ray.invDirection[a] >= 0.0f ? a : a + 3;
+            farRow[a] = ray.invDirection[a] >= 0.0f ? a + 3 : a;
+        }
+    }
+
+    int nearRow[3];
+    int farRow[3];
+};
+
+// Slab test of all children of a node. Writes every child's entry distance
+// and returns a bit mask of the children that are hit.
+template <int N>
+inline unsigned IntersectWideBVHNode(const WideBVHNode<N> &node, const BVHRay &ray,
+                                     const WideBVHRayOctant &octant, float *tEnter)
+{
+    unsigned mask = 0;
+    for (int i = 0; i < N; ++i) {
+        float tNear = ray.tMin;
+        float tFar = ray.tMax;
+        for (int a = 0; a < 3; ++a) {
+            tNear = std::max(tNear, (node.bounds[octant.nearRow[a]][i] - ray.origin[a]) * ray.invDirection[a]);
+            tFar = std::min(tFar, (node.bounds[octant.farRow[a]][i] - ray.origin[a]) * ray.invDirection[a] * 1.00000024f);
+        }
+        tEnter[i] = tNear;
+        mask |= static_cast<unsigned>(tNear <= tFar) << i;
+    }
+    return mask;
+}
+
+// Same test for quantized nodes, decoding the child bounds on the fly.
+template <int N>
+inline unsigned IntersectWideBVHNode(const QuantizedWideBVHNode<N> &node, const BVHRay &ray,
+                                     const WideBVHRayOctant &octant, float *tEnter)
+{
+    float scale[3];
+    for (int a = 0; a < 3; ++a) {
+        scale[a] = std::ldexp(1.0f, node.exponent[a]);
+    }
+
+    unsigned mask = 0;
+    for (int i = 0; i < N; ++i) {
+        float tNear = ray.tMin;
+        float tFar = ray.tMax;
+        for (int a = 0; a < 3; ++a) {
+            const float lo = node.origin[a] + node.bounds[octant.nearRow[a]][i] * scale[a];
+            const float hi = node.origin[a] + node.bounds[octant.farRow[a]][i] * scale[a];
+            tNear = std::max(tNear, (lo - ray.origin[a]) * ray.invDirection[a]);
+            tFar = std::min(tFar, (hi - ray.origin[a]) * ray.invDirection[a] * 1.00000024f);
+        }
+        tEnter[i] = tNear;
+        mask |= static_cast<unsigned>(tNear <= tFar) << i;
+    }
+    return mask & ((1u << node.numChildren) - 1u);
+}
+
+// The SIMD versions pass the running tNear and tFar as the second operand of
+// max and min, which is what those return when either operand is NaN. A ray
+// lying in a slab plane gets 0 * inf there, and that way ignores the slab
+// just as std::max and std::min do in the loops above.
+#if defined(__SSE2__) || defined(_M_X64)
+template <>
+inline unsigned IntersectWideBVHNode<4>(const WideBVHNode<4> &node, const BVHRay &ray,
+                                        const WideBVHRayOctant &octant, float *tEnter)
+{
+    __m128 tNear = _mm_set1_ps(ray.tMin);
+    __m128 tFar = _mm_set1_ps(ray.tMax);
+    const __m128 widen = _mm_set1_ps(1.00000024f);
+
+    for (int a = 0; a < 3; ++a) {
+        const __m128 origin = _mm_set1_ps(ray.origin[a]);
+        const __m128 invDirection = _mm_set1_ps(ray.invDirection[a]);
+        const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[octant.nearRow[a]]), origin), invDirection);
+        const __m128 t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[octant.farRow[a]]), origin), invDirection), widen);
+        tNear = _mm_max_ps(t0, tNear);
+        tFar = _mm_min_ps(t1, tFar);
+    }
+
+    _mm_storeu_ps(tEnter, tNear);
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+}
+
+// Four grid coordinates widened to floats.
+inline __m128 DecodeQuantizedBVHBounds(const uint8_t *q)
+{
+    int32_t packed;
+    std::memcpy(&packed, q, sizeof(packed));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bytes = _mm_cvtsi32_si128(packed);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+}
+
+template <>
+inline unsigned IntersectWideBVHNode<4>(const QuantizedWideBVHNode<4> &node, const BVHRay &ray,
+                                        const WideBVHRayOctant &octant, float *tEnter)
+{
+    __m128 tNear = _mm_set1_ps(ray.tMin);
+    __m128 tFar = _mm_set1_ps(ray.tMax);
+    const __m128 widen = _mm_set1_ps(1.00000024f);
+
+    for (int a = 0; a < 3; ++a) {
+        const __m128 nodeOrigin = _mm_set1_ps(node.origin[a]);
+        const __m128 scale = _mm_set1_ps(std::ldexp(1.0f, node.exponent[a]));
+        const __m128 lo = _mm_add_ps(nodeOrigin, _mm_mul_ps(DecodeQuantizedBVHBounds(node.bounds[octant.nearRow[a]]), scale));
+        const __m128 hi = _mm_add_ps(nodeOrigin, _mm_mul_ps(DecodeQuantizedBVHBounds(node.bounds[octant.farRow[a]]), scale));
+
+        const __m128 origin = _mm_set1_ps(ray.origin[a]);
+        const __m128 invDirection = _mm_set1_ps(ray.invDirection[a]);
+        tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(lo, origin), invDirection), tNear);
+        tFar = _mm_min_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(hi, origin), invDirection), widen), tFar);
+    }
+
+    _mm_storeu_ps(tEnter, tNear);
+    const unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+    return mask & ((1u << node.numChildren) - 1u);
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline unsigned IntersectWideBVHNode<8>(const WideBVHNode<8> &node, const BVHRay &ray,
+                                        const WideBVHRayOctant &octant, float *tEnter)
+{
+    __m256 tNear = _mm256_set1_ps(ray.tMin);
+    __m256 tFar = _mm256_set1_ps(ray.tMax);
+    const __m256 widen = _mm256_set1_ps(1.00000024f);
+
+    for (int a = 0; a < 3; ++a) {
+        const __m256 origin = _mm256_set1_ps(ray.origin[a]);
+        const __m256 invDirection = _mm256_set1_ps(ray.invDirection[a]);
+        const __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[octant.nearRow[a]]), origin), invDirection);
+        const __m256 t1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[octant.farRow[a]]), origin), invDirection), widen);
+        tNear = _mm256_max_ps(t0, tNear);
+        tFar = _mm256_min_ps(t1, tFar);
+    }
+
+    _mm256_storeu_ps(tEnter, tNear);
+    return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+}
+#endif
+
+#if defined(__AVX2__)
+template <>
+inline unsigned IntersectWideBVHNode<8>(const QuantizedWideBVHNode<8> &node, const BVHRay &ray,
+                                        const WideBVHRayOctant &octant, float *tEnter)
+{
+    __m256 tNear = _mm256_set1_ps(ray.tMin);
+    __m256 tFar = _mm256_set1_ps(ray.tMax);
+    const __m256 widen = _mm256_set1_ps(1.00000024f);
+
+    for (int a = 0; a < 3; ++a) {
+        const __m256 nodeOrigin = _mm256_set1_ps(node.origin[a]);
+        const __m256 scale = _mm256_set1_ps(std::ldexp(1.0f, node.exponent[a]));
+        const __m256 qlo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(node.bounds[octant.nearRow[a]]))));
+        const __m256 qhi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(node.bounds[octant.farRow[a]]))));
+        const __m256 lo = _mm256_add_ps(nodeOrigin, _mm256_mul_ps(qlo, scale));
+        const __m256 hi = _mm256_add_ps(nodeOrigin, _mm256_mul_ps(qhi, scale));
+
+        const __m256 origin = _mm256_set1_ps(ray.origin[a]);
+        const __m256 invDirection = _mm256_set1_ps(ray.invDirection[a]);
+        tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(lo, origin), invDirection), tNear);
+        tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(hi, origin), invDirection), widen), tFar);
+    }
+
+    _mm256_storeu_ps(tEnter, tNear);
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+    return mask & ((1u << node.numChildren) - 1u);
+}
+#endif
+
+// Index of the lowest set bit of a non-zero child mask.
+inline int WideBVHLowestBit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Number of set bits in a lane or child mask.
+inline int WideBVHBitCount(unsigned mask)
+{
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt(mask));
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+// An N-ary BVH collapsed from a binary one, optionally with quantized nodes.
+// Leaves keep referencing ranges of the binary BVH's GetPrimIndices(), so
+// primitive data laid out for the binary tree is used as is.
+template <int N, bool Quantized = false>
+class WideBVH final {
+    static_assert(N == 4 || N == 8, "WideBVH supports widths of 4 and 8");
+
+    public:
+        static constexpr int Width = N;
+
+        typedef typename std::conditional<Quantized,
+                                          QuantizedWideBVHNode<N>,
+                                          WideBVHNode<N>>::type Node;
+
+        // Rebuild from a binary BVH, pulling up grandchildren with the largest
+        // surface area until every node has N children or only leaves remain.
+        void Collapse(const BVH &bvh);
+
+        void Clear() {
+            _nodes.clear();
+        }
+
+        bool IsEmpty() const {
+            return _nodes.empty();
+        }
+
+        const MappedVector<Node> &GetNodes() const {
+            return _nodes;
+        }
+
+        size_t GetMemorySize() const {
+            return _nodes.capacity() * sizeof(Node);
+        }
+
+        // Visit the leaves the ray passes through, nearest first. leafFunc(first,
+        // count) is handed a range of BVH::GetPrimIndices() and may shorten
+        // ray.tMax when it finds a hit; nodes entered beyond it are skipped.
+        template <class LeafFunc>
+        void Traverse(BVHRay &ray, LeafFunc &&leafFunc) const;
+
+        // Any hit query for occlusion. leafFunc(first, count) returns true as
+        // soon as one of its primitives is hit inside [ray.tMin, ray.tMax],
+        // which ends the traversal.
+        template <class LeafFunc>
+        bool TraverseAny(const BVHRay &ray, LeafFunc &&leafFunc) const;
+
+        // Closest hit traversal of several rays at once. Lanes in activeMask
+        // that share an octant go down the tree together and are only split
+        // up once fewer than RayPacketMinActive of them remain below a node.
+        // leafFunc(first, count, laneMask) gets the lanes that reach a leaf
+        // and may shorten their packet.tMax.
+        template <class LeafFunc>
+        void TraversePacket(BVHRayPacket &packet, uint32_t activeMask, LeafFunc &&leafFunc) const;
+
+    private:
+        uint32_t _CollapseRecursive(const std::vector<BVHFlatNode> &binaryNodes, uint32_t binaryIndex);
+
+        void _SetLeaf(uint32_t nodeIndex, int slot, const BVHBounds &bounds,
+                      uint32_t first, uint32_t count);
+
+        static BVHBounds _GetBounds(const BVHFlatNode &node) {
+            BVHBounds bounds;
+            bounds.min = GfVec3f(node.min[0], node.min[1], node.min[2]);
+            bounds.max = GfVec3f(node.max[0], node.max[1], node.max[2]);
+            return bounds;
+        }
+
+        struct _StackEntry {
+            uint32_t child;
+            uint32_t count;
+            float tEnter;
+        };
+
+        struct _PacketStackEntry {
+            uint32_t child;
+            uint32_t count;
+            uint32_t laneMask;
+            // Nearest entry distance among the lanes.
+            float tEnter;
+        };
+
+        // Single ray traversal of the subtree below start.
+        template <class LeafFunc>
+        void _Traverse(BVHRay &ray, const _StackEntry &start, LeafFunc &&leafFunc) const;
+
+        template <class LeafFunc>
+        void _TraverseOctant(BVHRayPacket &packet, uint32_t laneMask, LeafFunc &&leafFunc) const;
+
+        // Every node visited pushes at most N children. Leaves spread out by
+        // _SetLeaf add at most 12 levels below the binary tree's depth.
+        static constexpr int _StackSize = N * (BVH::MaxDepth + 12) + 1;
+
+        MappedVector<Node> _nodes;
+};
+
+template <int N, bool Quantized>
+void WideBVH<N, Quantized>::Collapse(const BVH &bvh)
+{
+    _nodes.clear();
+
+    const std::vector<BVHFlatNode> &binaryNodes = bvh.GetNodes();
+    if (binaryNodes.empty())
+        return;
+
+    // Each wide node replaces at least one binary inner node.
+    _nodes.reserve(binaryNodes.size() / 2 + 1);
+    _CollapseRecursive(binaryNodes, 0);
+}
+
+template <int N, bool Quantized>
+uint32_t WideBVH<N, Quantized>::_CollapseRecursive(const std::vector<BVHFlatNode> &binaryNodes, uint32_t binaryIndex)
+{
+    const uint32_t nodeIndex = static_cast<uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+
+    // Gather up to N binary nodes below this one, opening the largest inner
+    // node each time. A binary leaf at the root becomes the only child.
+    uint32_t slots[N];
+    int numSlots = 0;
+
+    const BVHFlatNode &binaryNode = binaryNodes[binaryIndex];
+    if (binaryNode.IsLeaf()) {
+        slots[numSlots++] = binaryIndex;
+    } else {
+        slots[numSlots++] = binaryIndex + 1;
+        slots[numSlots++] = binaryNode.offset;
+    }
+
+    while (numSlots < N) {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < numSlots; ++i) {
+            const BVHFlatNode &node = binaryNodes[slots[i]];
+            if (node.IsLeaf())
+                continue;
+            const float area = _GetBounds(node).GetHalfArea();
+            if (area > largestArea) {
+                largestArea = area;
+                largest = i;
+            }
+        }
+
+        if (largest < 0)
+            break;
+
+        const uint32_t opened = slots[largest];
+        slots[largest] = opened + 1;
+        slots[numSlots++] = binaryNodes[opened].offset;
+    }
+
+    _nodes[nodeIndex].Init(_GetBounds(binaryNode));
+
+    for (int i = 0; i < numSlots; ++i) {
+        const BVHFlatNode &node = binaryNodes[slots[i]];
+        const BVHBounds bounds = _GetBounds(node);
+
+        if (node.IsLeaf()) {
+            _SetLeaf(nodeIndex, i, bounds, node.offset, node.count);
+        } else {
+            // May reallocate _nodes, so index it again afterwards.
+            const uint32_t child = _CollapseRecursive(binaryNodes, slots[i]);
+            _nodes[nodeIndex].SetChild(i, bounds, child, 0);
+        }
+    }
+
+    return nodeIndex;
+}
+
+template <int N, bool Quantized>
+void WideBVH<N, Quantized>::_SetLeaf(uint32_t nodeIndex, int slot, const BVHBounds &bounds,
+                                     uint32_t first, uint32_t count)
+{
+    if (count <= Node::MaxLeafCount) {
+        _nodes[nodeIndex].SetChild(slot, bounds, first, count);
+        return;
+    }
+
+    // Too many primitives for one slot, so spread them over the slots of a
+    // node of their own, all sharing the leaf's bounds.
+    const uint32_t spreadIndex = static_cast<uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+    _nodes[spreadIndex].Init(bounds);
+
+    const uint32_t chunk = count / N + (count % N != 0);
+    for (uint32_t i = 0; i < N && i * chunk < count; ++i) {
+        _SetLeaf(spreadIndex, static_cast<int>(i), bounds, first + i * chunk,
+                 std::min(chunk, count - i * chunk));
+    }
+
+    _nodes[nodeIndex].SetChild(slot, bounds, spreadIndex, 0);
+}
+
+template <int N, bool Quantized>
+template <class LeafFunc>
+void WideBVH<N, Quantized>::Traverse(BVHRay &ray, LeafFunc &&leafFunc) const
+{
+    if (_nodes.empty())
+        return;
+
+    _Traverse(ray, {0, 0, ray.tMin}, leafFunc);
+}
+
+template <int N, bool Quantized>
+template <class LeafFunc>
+void WideBVH<N, Quantized>::_Traverse(BVHRay &ray, const _StackEntry &start, LeafFunc &&leafFunc) const
+{
+    const WideBVHRayOctant octant(ray);
+
+    _StackEntry stack[_StackSize];
+    int stackSize = 0;
+    stack[stackSize++] = start;
+
+    while (stackSize > 0)
+    {
+        const _StackEntry entry = stack[--stackSize];
+
+        // A closer hit was found since this entry was pushed.
+        if (entry.tEnter > ray.tMax)
+            continue;
+
+        if (entry.count != 0)
+        {
+            leafFunc(entry.child, entry.count);
+            continue;
+        }
+
+        const Node &node = _nodes[entry.child];
+
+        float tEnter[N];
+        unsigned mask = IntersectWideBVHNode<N>(node, ray, octant, tEnter);
+
+        // Sort the children that were hit nearest first.
+        _StackEntry hits[N];
+        int numHits = 0;
+        while (mask)
+        {
+            const int i = WideBVHLowestBit(mask);
+            mask &= mask - 1;
+
+            _StackEntry hit = {node.child[i], node.count[i], tEnter[i]};
+            int j = numHits++;
+            while (j > 0 && hits[j - 1].tEnter > hit.tEnter)
+            {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = hit;
+        }
+
+        // Push the farthest first so the nearest is visited next.
+        for (int i = numHits - 1; i >= 0; --i)
+        {
+            stack[stackSize++] = hits[i];
+        }
+    }
+}
+
+template <int N, bool Quantized>
+template <class LeafFunc>
+bool WideBVH<N, Quantized>::TraverseAny(const BVHRay &ray, LeafFunc &&leafFunc) const
+{
+    if (_nodes.empty())
+        return false;
+
+    const WideBVHRayOctant octant(ray);
+
+    uint32_t stack[_StackSize];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node &node = _nodes[stack[--stackSize]];
+
+        float tEnter[N];
+        unsigned mask = IntersectWideBVHNode<N>(node, ray, octant, tEnter);
+
+        while (mask)
+        {
+            const int i = WideBVHLowestBit(mask);
+            mask &= mask - 1;
+
+            if (node.count[i] == 0)
+            {
+                stack[stackSize++] = node.child[i];
+            }
+            else if (leafFunc(node.child[i], node.count[i]))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+template <int N, bool Quantized>
+template <class LeafFunc>
+void WideBVH<N, Quantized>::TraversePacket(BVHRayPacket &packet, uint32_t activeMask, LeafFunc &&leafFunc) const
+{
+    if (_nodes.empty())
+        return;
+
+    // The slab test picks near and far planes per packet, so rays pointing
+    // into different octants have to go down the tree separately.
+    uint32_t octantMasks[8] = {};
+    for (uint32_t mask = activeMask; mask; mask &= mask - 1)
+    {
+        const int lane = WideBVHLowestBit(mask);
+        octantMasks[packet.GetOctant(lane)] |= 1u << lane;
+    }
+
+    for (uint32_t laneMask : octantMasks)
+    {
+        if (laneMask)
+            _TraverseOctant(packet, laneMask, leafFunc);
+    }
+}
+
+template <int N, bool Quantized>
+template <class LeafFunc>
+void WideBVH<N, Quantized>::_TraverseOctant(BVHRayPacket &packet, uint32_t laneMask, LeafFunc &&leafFunc) const
+{
+    const WideBVHRayOctant octant(packet.GetRay(WideBVHLowestBit(laneMask)));
+
+    _PacketStackEntry stack[_StackSize];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0, laneMask, -std::numeric_limits<float>::infinity()};
+
+    while (stackSize > 0)
+    {
+        const _PacketStackEntry entry = stack[--stackSize];
+
+        // Skip the entry once every lane has found a closer hit.
+        float tMax = -std::numeric_limits<float>::infinity();
+        for (uint32_t mask = entry.laneMask; mask; mask &= mask - 1)
+        {
+            tMax = std::max(tMax, packet.tMax[WideBVHLowestBit(mask)]);
+        }
+        if (entry.tEnter > tMax)
+            continue;
+
+        // Too few rays left to share the work, so finish them one by one.
+        if (WideBVHBitCount(entry.laneMask) < RayPacketMinActive)
+        {
+            for (uint32_t mask = entry.laneMask; mask; mask &= mask - 1)
+            {
+                const int lane = WideBVHLowestBit(mask);
+                const uint32_t laneBit = 1u << lane;
+
+                BVHRay ray = packet.GetRay(lane);
+                _Traverse(ray, {entry.child, entry.count, ray.tMin}, [&](uint32_t first, uint32_t count)
+                {
+                    leafFunc(first, count, laneBit);
+                    ray.tMax = packet.tMax[lane];
+                });
+            }
+            continue;
+        }
+
+        if (entry.count != 0)
+        {
+            leafFunc(entry.child, entry.count, entry.laneMask);
+            continue;
+        }
+
+        const Node &node = _nodes[entry.child];
+
+        // Sort the children that were hit nearest first.
+        _PacketStackEntry hits[N];
+        int numHits = 0;
+        for (int i = 0; i < N; ++i)
+        {
+            float bounds[6];
+            node.GetChildBounds(i, bounds);
+
+            float tEnter;
+            const uint32_t hitMask = IntersectBVHRayPacket(packet, entry.laneMask,
+                                                           octant.nearRow, octant.farRow,
+                                                           bounds, &tEnter);
+            if (hitMask == 0)
+                continue;
+
+            _PacketStackEntry hit = {node.child[i], node.count[i], hitMask, tEnter};
+            int j = numHits++;
+            while (j > 0 && hits[j - 1].tEnter > hit.tEnter)
+            {
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = hit;
+        }
+
+        // Push the farthest first so the nearest is visited next.
+        for (int i = numHits - 1; i >= 0; --i)
+        {
+            stack[stackSize++] = hits[i];
+        }
+    }
+}
+
+// The layout the renderer's acceleration structures are traversed with.
+typedef WideBVH<HDTEMPLATE_BVH_WIDTH, HDTEMPLATE_BVH_QUANTIZED != 0> RenderBVH;
+
+PXR_NAMESPACE_CLOSE_SCOPE